@@ -23,8 +23,18 @@ i9 * - Copyright of Student Code: You!
 #include <sys/time.h>
 #include <pthread.h>
 #include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 // Local Includes
 #include "op_sched.h"
+#include "op_sched_ext.h"
+#include "op_trace.h"
+#include "op_export.h"
 #include "vm_support.h"
 #include "vm_process.h"
 
@@ -37,8 +47,118 @@ i9 * - Copyright of Student Code: You!
 //flag used to modify 28 least significant bits of process state
 #define STATE_FLAG 0x0FFFFFFF
 
-//indicates a process is starving
-#define MAX_AGE 5
+//starting number of buckets/entries in the command intern table (power of 2)
+#define CMD_TABLE_START 256
+
+/*
+ * One interned command: the shared string, how many processes use it and
+ * the stats those processes have accumulated.
+ */
+typedef struct op_cmd_entry_struct {
+	char *str;            //the shared, immutable command string (NULL for a free slot)
+	unsigned int hash;    //cached hash of str
+	unsigned int refs;    //number of processes using this command
+	int next;             //next id in the same bucket, or in the free list
+	Op_cmd_stats_s stats; //aggregated scheduling stats
+} Op_cmd_entry_s;
+
+//queues keep their tail and critical count up to date only with the tail engine,
+//the walk engine is the plain linked list of the starter code
+#define QUEUE_BOOKKEEPING (OP_QUEUE_ENGINE == OP_ENGINE_TAIL)
+
+//classes a group's picks take turns between (group_pick), in the order a round hands them out
+#define SELECT_HIGH 0
+#define SELECT_SJF  1
+#define SELECT_LOW  2
+#define SELECT_CLASSES 3
+
+//bumps a counter only in builds with OP_FEATURE_STATS
+#define STAT_INC(counter) do { if(OP_FEATURE_STATS){ (counter)++; } } while(0)
+
+//largest trace ring op_trace_enable will allocate (2^24 records = 384MB)
+#define TRACE_MAX_LOG2 24
+
+//smallest gang mark table, it grows to twice the low queue it's used on
+#define GANG_MARKS_START 16
+
+//slots in a spill store's ring of due ticks (a spilled process starves at most MAX_AGE ticks out)
+#define SPILL_DUE_SLOTS (MAX_AGE + 1)
+
+//records a spill store's mapping starts with, it doubles from there
+#define SPILL_START 4096
+
+//where op_set_spill makes its file by default (on disk on most systems, unlike a tmpfs /tmp)
+#define SPILL_DIR "/var/tmp"
+
+/*
+ * A spilled low process: its fields and the promotion tick it was spilled on,
+ * so its current age is age + (ticks - spill_tick).
+ * A process added with op_add keeps its node (the caller may still hold it): the record
+ * points at it and the node's own fields win when it comes back. One added with
+ * op_add_owned has its node freed, the record is all that's left of it.
+ */
+typedef struct op_spill_rec_struct {
+	Op_process_s *node;       //the process itself while it's spilled, NULL if it was freed
+	pid_t pid;
+	unsigned int state;
+	int age;                  //age when it was spilled
+	unsigned int cmd_id;      //its reference on the interned command is kept while it's spilled
+	unsigned int gang;
+	unsigned int sched_class;
+	unsigned int bursts;
+	unsigned int dead;        //terminated while spilled, skipped when paging in
+	unsigned long long spill_tick;
+	unsigned long long run_total_ns;
+	unsigned long long burst_avg_ns;
+	unsigned long long quantum_ns;
+	unsigned long long burst_run_ns;
+} Op_spill_rec_s;
+
+/*
+ * Overflow store of a low queue: an append-only segment of records in a shared file mapping,
+ * so spilled processes cost page cache (which the kernel can write back) instead of heap.
+ * Records are numbered in the order they were spilled: [head, tail) are still spilled
+ * (minus the dead ones) and recs[0] is record number base.
+ */
+typedef struct op_spill_struct {
+	int fd;
+	Op_spill_rec_s *recs;
+	unsigned long long capacity; //records the mapping holds
+	unsigned long long base;
+	unsigned long long head;
+	unsigned long long tail;
+	unsigned long long dropped;  //pages holding records before this one were given back
+	int count;                   //live records
+	int window;                  //processes kept in the list before new ones spill
+	unsigned long long ticks;    //op_promote_processes calls since spilling started
+	unsigned long long due[SPILL_DUE_SLOTS]; //per tick (mod slots): 1 + last record that starves on it
+} Op_spill_s;
+
+//defunct processes op_export_defunct writes at a time, and the size of its csv write buffer
+#define EXPORT_BATCH 4096
+#define EXPORT_BUFFER (64 * 1024)
+
+/*
+ * One batch of defunct processes on its way out, with room for the columnar layout.
+ */
+typedef struct op_export_batch_buf_struct {
+	Op_process_s *procs[EXPORT_BATCH];
+	int32_t pids[EXPORT_BATCH];
+	uint32_t codes[EXPORT_BATCH];
+	uint32_t cmd_ids[EXPORT_BATCH];
+	char csv[EXPORT_BUFFER];
+	size_t csv_used;
+} Op_export_buf_s;
+
+//command intern table: entries indexed by id, chained hash buckets of ids
+//(one table for the whole program, shared by every schedule and not thread safe, see op_sched_ext.h)
+static Op_cmd_entry_s *cmd_entries = NULL;
+static unsigned int cmd_capacity = 0;  //allocated entries
+static unsigned int cmd_used = 0;      //entries ever handed out (ids below this are valid slots)
+static unsigned int cmd_live = 0;      //entries currently holding a command
+static int cmd_free = -1;              //first free slot, -1 if none
+static int *cmd_buckets = NULL;        //first id in each bucket, -1 if empty
+static unsigned int cmd_nbuckets = 0;  //always a power of 2
 
 
 //HELPER FUNCTION PROTOTYPES
@@ -53,6 +173,46 @@ Op_process_s *remove_process(Op_queue_s *queue, int position);
 int first_crit_pos(Op_queue_s *queue);
 int search_pid(Op_queue_s *queue, pid_t pid);
 void dealloc_queue(Op_queue_s *queue);
+unsigned int hash_cmd(const char *command);
+int grow_cmd_buckets();
+int intern_cmd(const char *command);
+void release_cmd(unsigned int id);
+Op_watermark_s *queue_limits(Op_schedule_s *schedule, Op_queue_s *queue);
+void check_capacity(Op_schedule_s *schedule, Op_queue_s *queue);
+unsigned long long trace_ticks();
+unsigned long long trace_ns();
+void trace_op(Op_schedule_s *schedule, unsigned int op, Op_process_s *process, unsigned int queue);
+Op_process_s *select_high_queue(Op_queue_s *queue);
+int sjf_before(Op_process_s *a, Op_process_s *b);
+void sjf_sift_up(Op_schedule_ext_s *ext, int index);
+void sjf_sift_down(Op_schedule_ext_s *ext, int index);
+int sjf_push(Op_schedule_ext_s *ext, Op_process_s *process);
+Op_process_s *sjf_remove(Op_schedule_ext_s *ext, int index);
+void sjf_age(Op_schedule_ext_s *ext);
+Op_process_s *unlink_next(Op_queue_s *queue, Op_process_s *prev);
+int take_gang(Op_queue_s *queue, unsigned int gang, Op_process_s **selected, int max);
+int gang_marks_begin(Op_schedule_ext_s *ext, int count);
+Op_gang_mark_s *gang_mark_slot(Op_schedule_ext_s *ext, unsigned int gang);
+void promote_queue(Op_schedule_s *schedule, Op_group_s *group);
+void group_activate(Op_schedule_s *schedule, int id);
+void group_deactivate(Op_schedule_s *schedule, int id);
+int group_ready(Op_schedule_s *schedule, int id);
+int group_turn(Op_schedule_s *schedule);
+int group_crit(Op_schedule_s *schedule);
+Op_process_s *group_pick(Op_schedule_s *schedule, int id);
+int spill_make_room(Op_spill_s *spill);
+int spill_append(Op_queue_s *queue, Op_process_s *process, int owned);
+Op_process_s *spill_restore(Op_spill_s *spill, Op_spill_rec_s *rec);
+void spill_drop_pages(Op_spill_s *spill);
+int spill_page_in(Op_queue_s *queue, unsigned long long limit, int want);
+void spill_tick(Op_queue_s *queue);
+void spill_refill(Op_queue_s *queue);
+Op_process_s *spill_take(Op_queue_s *queue, pid_t pid);
+void spill_destroy(Op_spill_s *spill);
+int export_columns(FILE *out, Op_export_buf_s *buf, int count, unsigned int *marks, unsigned int batch);
+int export_put(FILE *out, Op_export_buf_s *buf, const char *data, size_t len);
+int export_csv(FILE *out, Op_export_buf_s *buf, int count);
+int add_process(Op_schedule_s *schedule, Op_process_s *process, int owned);
 
 /* HELPER to update the state of a process based 
  * by setting a specific pattern of state bits to be ON,
@@ -89,6 +249,11 @@ void unset_state(Op_process_s* process, unsigned int flag){
  */
 int check_crit(Op_process_s* process){
 
+	//no critical lane in this build -> never critical
+	if(!OP_FEATURE_CRITICAL){
+		return 0;
+	}
+
 	return (process->state & CRITICAL_FLAG)>>31;
 }
 
@@ -98,6 +263,11 @@ int check_crit(Op_process_s* process){
  */
 int check_low(Op_process_s* process){
 
+	//no low queue in this build -> never low
+	if(!OP_FEATURE_LOW){
+		return 0;
+	}
+
         return (process->state & LOW_FLAG)>>30;
 }
 
@@ -108,9 +278,9 @@ int check_low(Op_process_s* process){
  */
 Op_queue_s *queue_create(Op_queue_s *queue) {
 
-	//dynamically allocate memory for queue
+	//dynamically allocate memory for queue (wrapper also caches the tail)
         queue = NULL;
-        queue = malloc(sizeof(Op_queue_s));
+        queue = malloc(sizeof(Op_queue_ext_s));
 
         //return NULL for error allocating memory
         if(queue == NULL){
@@ -120,6 +290,10 @@ Op_queue_s *queue_create(Op_queue_s *queue) {
         //initialize queue fields 
         queue->head = NULL;
 	queue->count = 0;
+	QUEUE_EXT(queue)->tail = NULL;
+	QUEUE_EXT(queue)->crit_count = 0;
+	QUEUE_EXT(queue)->spill = NULL;
+	memset(&QUEUE_EXT(queue)->limits, 0, sizeof(Op_watermark_s));
 	
 	//return pointer to queue
 	return queue;
@@ -139,12 +313,18 @@ int append_queue(Op_queue_s *queue, Op_process_s *process){
 	}
 
 	//if queue is empty->update queue head
-	if(op_get_count(queue) == 0){
+	if(queue->count == 0){
 		
 		queue->head = process;
 		process->next = NULL;
 	}		
 	
+	//otherwise, add process after the cached tail
+	else if(OP_QUEUE_ENGINE == OP_ENGINE_TAIL){
+
+		QUEUE_EXT(queue)->tail->next = process;
+	}
+
 	//otherwise, loop through to end of queue and add process at end
 	else{
 
@@ -158,6 +338,11 @@ int append_queue(Op_queue_s *queue, Op_process_s *process){
 		walker->next = process;
 	}	
 
+	if(QUEUE_BOOKKEEPING){
+		QUEUE_EXT(queue)->tail = process;
+		QUEUE_EXT(queue)->crit_count += check_crit(process);
+	}
+
 	queue->count++; //increment queue count and return 0 for success
 	return 0;
 }
@@ -169,7 +354,7 @@ int append_queue(Op_queue_s *queue, Op_process_s *process){
  Op_process_s *remove_from_front(Op_queue_s *queue){
 	
 	//return NULL if queue is empty or unitialized
-	if(queue == NULL || op_get_count(queue) <= 0){
+	if(queue == NULL || queue->count <= 0){
 		return NULL;
 	}
 
@@ -181,8 +366,16 @@ int append_queue(Op_queue_s *queue, Op_process_s *process){
 	//update the queue head to point to the next process
 	queue->head = queue->head->next;
 
+	//removed the only process -> no tail either
+	if(QUEUE_BOOKKEEPING && queue->head == NULL){
+		QUEUE_EXT(queue)->tail = NULL;
+	}
+
 	//decrement size of queue
 	queue->count--;
+	if(QUEUE_BOOKKEEPING){
+		QUEUE_EXT(queue)->crit_count -= check_crit(removed_process);
+	}
 	
 	//set next to NULL to avoid unexpected values in other functions
 	removed_process->next = NULL;
@@ -200,7 +393,7 @@ int append_queue(Op_queue_s *queue, Op_process_s *process){
  Op_process_s *remove_process(Op_queue_s *queue, int position){
  
 	//if queue is uninitialized or position is out of bounds for queue -> ERROR
-	if(queue == NULL || position < 0 || position >= (op_get_count(queue))){
+	if(queue == NULL || position < 0 || position >= queue->count){
 		return NULL;
 	}
 
@@ -226,6 +419,14 @@ int append_queue(Op_queue_s *queue, Op_process_s *process){
 			walker->next = walker->next->next;
 			queue->count--;		
 
+			//removed the last process -> predecessor is the new tail
+			if(QUEUE_BOOKKEEPING){
+				QUEUE_EXT(queue)->crit_count -= check_crit(removed_process);
+				if(walker->next == NULL){
+					QUEUE_EXT(queue)->tail = walker;
+				}
+			}
+
 			//process is no longer pointing to anything or waiting to be processed
 			removed_process->next = NULL;
 			removed_process->age = 0;
@@ -248,7 +449,8 @@ int append_queue(Op_queue_s *queue, Op_process_s *process){
  */
 int first_crit_pos(Op_queue_s *queue){
 
-	if(queue == NULL){
+	//no critical lane in this build (or no critical process in the queue) -> nothing to look for
+	if(queue == NULL || !OP_FEATURE_CRITICAL || (QUEUE_BOOKKEEPING && QUEUE_EXT(queue)->crit_count == 0)){
 		return -1;
 	}
 
@@ -280,7 +482,7 @@ int first_crit_pos(Op_queue_s *queue){
 int search_pid(Op_queue_s *queue, pid_t pid){
 
 	//check for problematic input
-	if(queue == NULL || op_get_count(queue)<= 0){
+	if(queue == NULL || queue->count <= 0){
 		return -1;
 	}
 
@@ -307,275 +509,1984 @@ int search_pid(Op_queue_s *queue, pid_t pid){
         return -1;	
 }
 
-/*
- * Deallocates the contents of a queue.
+/* HELPER
+ * FNV-1a hash of a command string.
  */
-void dealloc_queue(Op_queue_s *queue){
+unsigned int hash_cmd(const char *command){
 
-	if(queue == NULL){
-		return;
+	unsigned int hash = 2166136261u;
+
+	while(*command != '\0'){
+		hash ^= (unsigned char)*command++;
+		hash *= 16777619u;
 	}
 
-	Op_process_s *walker = NULL; //copy of the head
-	Op_process_s *dead_process = NULL; //process being freed
+	return hash;
+}
 
-	walker = queue->head;
+/* HELPER
+ * Doubles the number of intern table buckets (or creates them) and rechains every live entry.
+ * Return 0 for success, -1 for error
+ */
+int grow_cmd_buckets(){
 
-	while(walker != NULL){
+	unsigned int new_count = cmd_nbuckets == 0 ? CMD_TABLE_START : cmd_nbuckets * 2;
+	int *new_buckets = malloc(sizeof(int) * new_count);
 
-		free(walker->cmd); //free command of dead_process
-		walker->cmd = NULL; // avoid dangling pointer
-		dead_process = walker; //save pointer to dead process
-		walker= walker->next; //go to next node
-		free(dead_process); //free dead_process
+	if(new_buckets == NULL){
+		return -1;
 	}
 
-	//free(queue->head); //free memory for queue head
-	queue->head = NULL;//make sure there's no dangling pointer
-	
-	free(queue); //free memory for queue
-	queue = NULL; //set memory address of freed queue to be NULL
-}
+	for(unsigned int i = 0; i < new_count; i++){
+		new_buckets[i] = -1;
+	}
 
+	//rechain live entries into the new buckets
+	for(unsigned int id = 0; id < cmd_used; id++){
 
-/*
- * Dynamically allocates memory for a schedule and its queues.
- * Return a pointer to the schedule created or NULL for error.
+		if(cmd_entries[id].str != NULL){
+			unsigned int bucket = cmd_entries[id].hash & (new_count - 1);
+			cmd_entries[id].next = new_buckets[bucket];
+			new_buckets[bucket] = id;
+		}
+	}
+
+	free(cmd_buckets);
+	cmd_buckets = new_buckets;
+	cmd_nbuckets = new_count;
+	return 0;
+}
+
+/* HELPER
+ * Looks up a command in the intern table, adding it if it's new, and takes a reference on it.
+ * Returns the command's id or -1 for error.
  */
-Op_schedule_s *op_create() {
+int intern_cmd(const char *command){
 
-	//make sched point to null (override garbage value)	
-	Op_schedule_s *sched = NULL;
+	unsigned int hash = hash_cmd(command);
 
-	//dynamically allocate memory for schedule
-	sched = malloc(sizeof(Op_schedule_s));
+	//look for an existing copy of the command
+	if(cmd_nbuckets > 0){
 
-	//NULL return -> ERROR
-	if(sched == NULL){
-		return NULL;
-	}
-	
-	//dynamically allocate memory for high queue
-	sched->ready_queue_high = queue_create(sched->ready_queue_high);
-        if(sched->ready_queue_high == NULL){
-                return NULL;
-        }
+		int id = cmd_buckets[hash & (cmd_nbuckets - 1)];
 
-	//dynamically allocate memory for low queue
-	sched->ready_queue_low = queue_create(sched->ready_queue_low);
-        if(sched->ready_queue_low == NULL){
-                return NULL;
-        }
+		while(id >= 0){
 
+			if(cmd_entries[id].hash == hash && strcmp(cmd_entries[id].str, command) == 0){
+				cmd_entries[id].refs++;
+				return id;
+			}
+			id = cmd_entries[id].next;
+		}
+	}
 
-	//dynamically allocate memory for defunct queue	
-	sched->defunct_queue = queue_create(sched->defunct_queue);
-	if(sched->defunct_queue == NULL){
-		return NULL;
-	} 
+	//keep about one entry per bucket
+	if(cmd_live >= cmd_nbuckets && grow_cmd_buckets() < 0){
+		return -1;
+	}
 
-	return sched;
-}
+	//make a private copy of the command (strlen + 1 for NULL terminator)
+	int cmd_length = strlen(command) + 1;
+	char *copy = malloc(sizeof(char) * cmd_length);
 
+	if(copy == NULL){
+		return -1;
+	}
+	strncpy(copy, command, cmd_length);
 
-/*
- * dynamically allocate memory for a process and initialize its fields
- *	-dynamically allocate memory for the command
- *	-set ready bit to 1, defunct bit to 0
- *	-is_low and is_critical determine if low and critical bits should be on or off
- *	-remaining 28 bits are set to 0
- * return NULL for error
- */ 	
-Op_process_s *op_new_process(char *command, pid_t pid, int is_low, int is_critical) {
+	//reuse a free slot, otherwise take a new one (growing the entry array if full)
+	int id = cmd_free;
 
-	//return NULL for error if command is null
-	if(command == NULL){
-		return NULL;
+	if(id >= 0){
+		cmd_free = cmd_entries[id].next;
 	}
-	
-	//override garbage value of process we are creating with NULL
-	Op_process_s *process = NULL;
+	else{
 
-	//dynamically allocate memory for the process
-	process = malloc(sizeof(Op_process_s));
-	
-	//NULL malloc -> ERROR
-	if(process == NULL) {
-		return NULL;
-	}		
+		if(cmd_used == cmd_capacity){
 
-	//dynamically allocate memory for command (strlen + 1 for NULL terminator)
-	int cmd_length = strlen(command) + 1;
-	process->cmd = malloc(sizeof(char) * cmd_length);
-	
-	//NULL malloc -> ERROR
-	if(process->cmd == NULL){
-		return NULL;
+			unsigned int new_capacity = cmd_capacity == 0 ? CMD_TABLE_START : cmd_capacity * 2;
+			Op_cmd_entry_s *new_entries = realloc(cmd_entries, sizeof(Op_cmd_entry_s) * new_capacity);
+
+			if(new_entries == NULL){
+				free(copy);
+				return -1;
+			}
+			cmd_entries = new_entries;
+			cmd_capacity = new_capacity;
+		}
+		id = cmd_used++;
 	}
-	
-	//copy over process command to process being created
-	strncpy(process->cmd, command, cmd_length);  
-		
-	process->pid = pid; //initialize id to provided id
-	process->age = 0; //initialize age to 0
-	process->next = NULL; //next to NULL
 
-	process->state = 0 | READY_FLAG; //initialize all state bits to be off except for ready bit	
+	//fill in the entry and chain it into its bucket
+	Op_cmd_entry_s *entry = &cmd_entries[id];
+	unsigned int bucket = hash & (cmd_nbuckets - 1);
+
+	entry->str = copy;
+	entry->hash = hash;
+	entry->refs = 1;
+	entry->stats.run_total_ns = 0;
+	entry->stats.bursts = 0;
+	entry->stats.processes = 0;
+	entry->stats.burst_avg_ns = 0;
+	entry->next = cmd_buckets[bucket];
+	cmd_buckets[bucket] = id;
+	cmd_live++;
+
+	return id;
+}
 
-	//return null for error is process if low and critical
-	if(is_low && is_critical){
-		return NULL;
+/* HELPER
+ * Drops a reference on an interned command, freeing it once no process uses it.
+ */
+void release_cmd(unsigned int id){
+
+	if(id >= cmd_used || cmd_entries[id].str == NULL){
+		return;
 	}
 
-	//initialize low and critical bits to match function input
-	else if(is_low){
-		set_state_on(process, LOW_FLAG);
+	Op_cmd_entry_s *entry = &cmd_entries[id];
+
+	if(--entry->refs > 0){
+		return;
 	}
 
-	else if(is_critical){
-		set_state_on(process, CRITICAL_FLAG);
+	//unlink from its bucket
+	int *link = &cmd_buckets[entry->hash & (cmd_nbuckets - 1)];
+
+	while(*link != (int)id){
+		link = &cmd_entries[*link].next;
 	}
-	
-	return process; //return pointer to the process being created
+	*link = entry->next;
+
+	//free the string and put the slot on the free list
+	free(entry->str);
+	entry->str = NULL;
+	entry->next = cmd_free;
+	cmd_free = id;
+	cmd_live--;
 }
 
+/* HELPER
+ * Returns the admission limits of a ready queue (of any group), or NULL if queue isn't one of the
+ * schedule's ready queues.
+ */
+Op_watermark_s *queue_limits(Op_schedule_s *schedule, Op_queue_s *queue){
 
-/*
- * First initializes ready bit of process to 1 and defunct bit to 0 (without changing critical or low bits)
- * Then appends a process to the queue corresponding to its low priority bit (update queue head if necessary)
- *	- 1 = low queue
- * 	- 0 = high queue
- *
- * return 0 for success, -1 for error
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+
+	for(int group = 0; group < ext->group_count; group++){
+		if(queue == ext->groups[group].high || queue == ext->groups[group].low){
+			return &QUEUE_EXT(queue)->limits;
+		}
+	}
+
+	return NULL;
+}
+
+/* HELPER
+ * Call after removing processes from a ready queue (of any group).
+ * Lifts the queue's throttle once it has drained to its low watermark (or lost its limits) and
+ * lets producers know through the capacity callback and/or eventfd.
  */
-int op_add(Op_schedule_s *schedule, Op_process_s *process) {
+void check_capacity(Op_schedule_s *schedule, Op_queue_s *queue){
 
-	
-	//S1: check for invalid arguments
-	if(schedule == NULL || process == NULL) {
-		return -1;
+	//a spilling queue that drained below half its window pages the next batch back in
+	spill_refill(queue);
+
+	Op_watermark_s *limits = &QUEUE_EXT(queue)->limits;
+
+	if(!limits->throttled || (limits->high_mark > 0 && op_get_count(queue) > limits->low_mark)){
+		return;
 	}
 
-	//S2: set ready bit ON, defunct bit OFF, next pointer to NULL
-	set_state_on(process, READY_FLAG);
-	unset_state(process, DEFUNCT_FLAG);
-	process->next = NULL;
-	
-	/*
-	* S3-4: check low bit to determine which
-	* queue to add process to and add it to that queue
-	*/
-	if(check_low(process)){
-		return append_queue(schedule->ready_queue_low, process);
+	limits->throttled = 0;
+
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+
+	if(ext->capacity_cb != NULL){
+		ext->capacity_cb(schedule, queue, ext->capacity_arg);
 	}
 
-	return append_queue(schedule->ready_queue_high, process);
+	//eventfd counters are bumped by writing an 8 byte value
+	if(ext->capacity_fd >= 0){
+		unsigned long long one = 1;
+		if(write(ext->capacity_fd, &one, sizeof(one)) < 0){
+			//counter saturated or fd gone, producers will see the queue drained on their next op_add
+		}
+	}
+}
+
+/* HELPER
+ * Cheapest clock available for trace records: the cycle counter on x86,
+ * the monotonic clock in ns anywhere else.
+ */
+unsigned long long trace_ticks(){
+
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return trace_ns();
+#endif
 }
 
+/* HELPER
+ * Monotonic clock in ns, sampled next to trace_ticks() to convert ticks to time.
+ */
+unsigned long long trace_ns(){
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-/*
- * Returns number of process in designated queue or -1 if queue is NULL
+	return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* HELPER
+ * Appends one record to the schedule's trace ring (if tracing is on).
+ * Slots are claimed with an atomic increment so concurrent callers never share one,
+ * and the oldest records are overwritten once the ring is full.
+ * seq works like a seqlock: it's 0 while the fields are being written and slot + 1 once
+ * they're done, so a reader that sees the same seq before and after copying has a whole record.
  */
-int op_get_count(Op_queue_s *queue){
+void trace_op(Op_schedule_s *schedule, unsigned int op, Op_process_s *process, unsigned int queue){
 
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
 
-	if(queue == NULL){
-		return -1;
+	if(!OP_FEATURE_TRACE || ext->trace_ring == NULL || process == NULL){
+		return;
 	}
 
-	return queue->count;
-}
+	unsigned long long slot = __atomic_fetch_add(&ext->trace_head, 1, __ATOMIC_RELAXED);
+	Op_trace_rec_s *rec = &ext->trace_ring[slot & ext->trace_mask];
 
+	//take down the record this slot held before touching any field
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
 
-/*
- * Removes and returns pointer to the first critical process in the high queue.
- * If there are no critical processes, perform same actions on first process instead.
- * -removed processes have their ages set to 0 and next pointers set to NULL
- *
- * Return NULL if queue is empty.
+	rec->ticks = trace_ticks();
+	rec->pid = process->pid;
+	rec->state = process->state;
+	rec->op = op;
+	rec->queue = queue;
+	rec->pad = 0;
+
+	//publish the record last so a reader can tell it's complete
+	__atomic_store_n(&rec->seq, (uint32_t)(slot + 1), __ATOMIC_RELEASE);
+}
+
+/* HELPER
+ * Removes the first critical process of a high queue, or its first process if
+ * there are no critical processes. Returns NULL if the queue is empty.
  */
-Op_process_s *op_select_high(Op_schedule_s *schedule){
+Op_process_s *select_high_queue(Op_queue_s *queue){
 
-	//check if schedule is NULL or queue is empty
-	if(schedule == NULL || op_get_count(schedule->ready_queue_high) <= 0){
-		return NULL;
-	}
-	
 	//search for position of first critical process in high queue
-	int critical_index = 0;	
-	critical_index = first_crit_pos(schedule->ready_queue_high); 
+	int critical_index = first_crit_pos(queue);
 
 	//critical process found -> remove first critical process 
 	if(critical_index >= 0){
-
-		return remove_process(schedule->ready_queue_high, critical_index);
+		return remove_process(queue, critical_index);
 	}
 
 	//critical process not found -> remove first process in queue
-	return remove_from_front(schedule->ready_queue_high);
+	return remove_from_front(queue);
 }
 
-/*
- * Removes and returns pointer to first process in the low queue.
- * Almost dentical to op_select_high but 
- * LOW QUEUE WILL NOT HAVE CRITICAL PROCESSES!
- *
- * Return NULL for error.
+/* HELPER
+ * SJF heap order: smaller predicted remaining burst first, then first added.
+ * Returns 1 if a goes before b.
  */
-Op_process_s *op_select_low(Op_schedule_s *schedule){
+int sjf_before(Op_process_s *a, Op_process_s *b){
 
-	if(schedule == NULL){
-		return NULL;
+	if(PROC_EXT(a)->sjf_key != PROC_EXT(b)->sjf_key){
+		return PROC_EXT(a)->sjf_key < PROC_EXT(b)->sjf_key;
 	}
-	
- 	return remove_from_front(schedule->ready_queue_low);
+
+	return PROC_EXT(a)->sjf_seq < PROC_EXT(b)->sjf_seq;
 }
 
-/*
- * Increases ages of all processes in low queue by 1.
- * Any processes with ages 5 or greater are removed from low queue and appended to high queue.
- * -removed processes have their ages set to 0 and their next pointers set to NULL
- *
- * Return 0 for success, -1 for errors
+/* HELPER
+ * Moves the heap entry at index up until its parent goes before it.
  */
-int op_promote_processes(Op_schedule_s *schedule){
-	
-        //check if schedule is NULL, low queue is empty, or high queue is NULL
-        if(schedule == NULL || schedule->ready_queue_high == NULL){
-                return -1;
-        }
-	
-	//empty queue -> return 0
-	else if(op_get_count(schedule->ready_queue_low) <= 0 ){
-		return 0;
-	}
+void sjf_sift_up(Op_schedule_ext_s *ext, int index){
 
-	//set up pointer for queue traversal
-	Op_process_s *walker = NULL;
-	walker = schedule->ready_queue_low->head;
+	Op_process_s *moving = ext->sjf_heap[index];
 
-	int position = 0;//this variable tracks list index, similar to arrays
+	while(index > 0){
+
+		int parent = (index - 1) / 2;
+
+		if(!sjf_before(moving, ext->sjf_heap[parent])){
+			break;
+		}
+
+		ext->sjf_heap[index] = ext->sjf_heap[parent];
+		index = parent;
+	}
+
+	ext->sjf_heap[index] = moving;
+}
+
+/* HELPER
+ * Moves the heap entry at index down until it goes before both children.
+ */
+void sjf_sift_down(Op_schedule_ext_s *ext, int index){
+
+	Op_process_s *moving = ext->sjf_heap[index];
+
+	while(1){
+
+		int child = index * 2 + 1;
+
+		if(child >= ext->sjf_count){
+			break;
+		}
+
+		//pick the child that goes first
+		if(child + 1 < ext->sjf_count && sjf_before(ext->sjf_heap[child + 1], ext->sjf_heap[child])){
+			child++;
+		}
+
+		if(!sjf_before(ext->sjf_heap[child], moving)){
+			break;
+		}
+
+		ext->sjf_heap[index] = ext->sjf_heap[child];
+		index = child;
+	}
+
+	ext->sjf_heap[index] = moving;
+}
+
+/* HELPER
+ * Adds a process to the SJF heap, growing it if needed.
+ * Return 0 for success, -1 for error
+ */
+int sjf_push(Op_schedule_ext_s *ext, Op_process_s *process){
+
+	if(ext->sjf_count == ext->sjf_capacity){
+
+		int new_capacity = ext->sjf_capacity == 0 ? 64 : ext->sjf_capacity * 2;
+		Op_process_s **new_heap = realloc(ext->sjf_heap, sizeof(Op_process_s *) * new_capacity);
+
+		if(new_heap == NULL){
+			return -1;
+		}
+		ext->sjf_heap = new_heap;
+		ext->sjf_capacity = new_capacity;
+	}
+
+	ext->sjf_heap[ext->sjf_count++] = process;
+	sjf_sift_up(ext, ext->sjf_count - 1);
+	return 0;
+}
+
+/* HELPER
+ * Removes and returns the heap entry at index (age set to 0, next to NULL).
+ */
+Op_process_s *sjf_remove(Op_schedule_ext_s *ext, int index){
+
+	Op_process_s *removed_process = ext->sjf_heap[index];
+
+	//last entry fills the hole, then goes whichever way restores the heap
+	ext->sjf_count--;
+
+	if(index < ext->sjf_count){
+		ext->sjf_heap[index] = ext->sjf_heap[ext->sjf_count];
+		sjf_sift_down(ext, index);
+		sjf_sift_up(ext, index);
+	}
+
+	removed_process->next = NULL;
+	removed_process->age = 0;
+	return removed_process;
+}
+
+/* HELPER
+ * Ages every process in the SJF heap by 1. Processes that reach MAX_AGE
+ * stop waiting for shorter jobs: their key drops to 0, which puts them
+ * ahead of everything but processes that were starving before them.
+ */
+void sjf_age(Op_schedule_ext_s *ext){
+
+	for(int index = 0; index < ext->sjf_count; index++){
+
+		Op_process_s *walker = ext->sjf_heap[index];
+
+		walker->age++;
+
+		//keys only ever drop, so moving up is enough
+		//(entries it swaps down past index were already aged this pass)
+		if(walker->age >= MAX_AGE && PROC_EXT(walker)->sjf_key != 0){
+			PROC_EXT(walker)->sjf_key = 0;
+			sjf_sift_up(ext, index);
+		}
+	}
+}
+
+/* HELPER
+ * Removes and returns the process after prev (the head if prev is NULL) without
+ * walking the queue. Returns NULL if there is no such process.
+ */
+Op_process_s *unlink_next(Op_queue_s *queue, Op_process_s *prev){
+
+	Op_process_s *removed_process = prev == NULL ? queue->head : prev->next;
+
+	if(removed_process == NULL){
+		return NULL;
+	}
+
+	//skip over the removed process and decrement queue size
+	if(prev == NULL){
+		queue->head = removed_process->next;
+	}
+	else{
+		prev->next = removed_process->next;
+	}
+	queue->count--;
+
+	//removed the last process -> prev is the new tail
+	if(QUEUE_BOOKKEEPING){
+		QUEUE_EXT(queue)->crit_count -= check_crit(removed_process);
+		if(removed_process->next == NULL){
+			QUEUE_EXT(queue)->tail = prev;
+		}
+	}
+
+	//process is no longer pointing to anything or waiting to be processed
+	removed_process->next = NULL;
+	removed_process->age = 0;
+
+	return removed_process;
+}
+
+/* HELPER
+ * Removes the ready members of a gang from a queue (in queue order) into selected,
+ * stopping once selected holds max processes. Returns how many were removed.
+ */
+int take_gang(Op_queue_s *queue, unsigned int gang, Op_process_s **selected, int max){
+
+	int taken = 0;
+	Op_process_s *prev = NULL;
+	Op_process_s *walker = queue->head;
+
+	while(walker != NULL && taken < max){
+
+		//gang member -> take it, prev stays put
+		if(PROC_EXT(walker)->gang == gang){
+			walker = walker->next;
+			selected[taken++] = unlink_next(queue, prev);
+		}
+		else{
+			prev = walker;
+			walker = walker->next;
+		}
+	}
+
+	return taken;
+}
+
+/* HELPER
+ * Starts a new pass over a queue of count processes on the schedule's gang mark table:
+ * grows the table to at least twice count (so probes stay short and it never fills) and
+ * moves to a new stamp, which empties it without touching the slots.
+ * Return 0 for success, -1 for error (no table, gangs can't be marked this pass)
+ */
+int gang_marks_begin(Op_schedule_ext_s *ext, int count){
+
+	unsigned int size = ext->gang_marks == NULL ? 0 : ext->gang_mark_mask + 1;
+
+	if(size < GANG_MARKS_START || size < (unsigned int)count * 2){
+
+		unsigned int new_size = size < GANG_MARKS_START ? GANG_MARKS_START : size;
+
+		while(new_size < (unsigned int)count * 2){
+			new_size *= 2;
+		}
+
+		//zeroed slots carry stamp 0, which no pass uses
+		Op_gang_mark_s *new_marks = calloc(new_size, sizeof(Op_gang_mark_s));
+
+		if(new_marks == NULL){
+			return -1;
+		}
+		free(ext->gang_marks);
+		ext->gang_marks = new_marks;
+		ext->gang_mark_mask = new_size - 1;
+	}
+
+	//stamp wrapped around -> slots from 2^32 passes ago would look current, clear them for real
+	if(++ext->gang_stamp == 0){
+		memset(ext->gang_marks, 0, sizeof(Op_gang_mark_s) * (ext->gang_mark_mask + 1));
+		ext->gang_stamp = 1;
+	}
+
+	return 0;
+}
+
+/* HELPER
+ * Finds a gang's slot in the gang mark table: the slot marking it this pass,
+ * or the empty slot it would go in (stamp isn't the current one).
+ */
+Op_gang_mark_s *gang_mark_slot(Op_schedule_ext_s *ext, unsigned int gang){
+
+	unsigned int slot = (gang * 2654435761u) & ext->gang_mark_mask;
+
+	while(ext->gang_marks[slot].stamp == ext->gang_stamp && ext->gang_marks[slot].gang != gang){
+		slot = (slot + 1) & ext->gang_mark_mask;
+	}
+
+	return &ext->gang_marks[slot];
+}
+
+/* HELPER
+ * Ages every process in a group's low queue by 1 and moves the starving ones
+ * (age MAX_AGE or more) to the end of the group's high queue.
+ * Gangs age as a unit: once one member starves, every member in the queue is promoted with it.
+ */
+void promote_queue(Op_schedule_s *schedule, Op_group_s *group){
+
+	//gangs with a starving member this tick (if there's no memory for the table, members just promote on their own)
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+	int marking = gang_marks_begin(ext, group->low->count) == 0;
+
+	//set up pointer for queue traversal
+	Op_process_s *walker = NULL;
+	walker = group->low->head;
+
+	//first pass: age every process and note which gangs have a starving member
+	while(walker != NULL){
+
+		walker->age++; //increment age for each process
+
+		unsigned int gang = PROC_EXT(walker)->gang;
+
+		if(walker->age >= MAX_AGE && gang != 0 && marking){
+
+			Op_gang_mark_s *mark = gang_mark_slot(ext, gang);
+
+			mark->gang = gang;
+			mark->stamp = ext->gang_stamp;
+		}
+
+		walker = walker->next;
+	}
+
+	//second pass: promote starving processes and the rest of their gangs
+	Op_process_s *prev = NULL;
+	walker = group->low->head;
+
+	while(walker != NULL){
+
+		int promote = walker->age >= MAX_AGE;
+		unsigned int gang = PROC_EXT(walker)->gang;
+
+		if(!promote && gang != 0 && marking){
+			promote = gang_mark_slot(ext, gang)->stamp == ext->gang_stamp;
+		}
+
+		/*if starving process is found -> promote it to high queue*/
+		if(promote) {
+			
+			walker = walker->next; //set walker for next iteration (so we don't lose )
+
+			Op_process_s *promoted = unlink_next(group->low, prev); //delete current process and promote it to high queue
+			append_queue(group->high, promoted);
+			trace_op(schedule, OP_TRACE_PROMOTE, promoted, OP_TRACE_Q_HIGH);
+			STAT_INC(group->stats.promoted);
+		}
+		
+		//if starving process not found, iterate traditionally
+		else{
+			prev = walker;
+			walker = walker->next;
+		}
+	}
+}
+
+/* HELPER
+ * Makes room for one more record at the end of a spill store: slides the live records
+ * to the front when at least half the mapping was already paged back in, otherwise
+ * doubles the file and maps it again.
+ * Return 0 for success, -1 for error
+ */
+int spill_make_room(Op_spill_s *spill){
+
+	if(spill->tail - spill->base < spill->capacity){
+		return 0;
+	}
+
+	if(spill->head - spill->base >= spill->capacity / 2){
+
+		memmove(spill->recs, spill->recs + (spill->head - spill->base), sizeof(Op_spill_rec_s) * (spill->tail - spill->head));
+		spill->base = spill->head;
+		spill->dropped = spill->head;
+		return 0;
+	}
+
+	unsigned long long new_capacity = spill->capacity * 2;
+
+	if(ftruncate(spill->fd, sizeof(Op_spill_rec_s) * new_capacity) < 0){
+		return -1;
+	}
+
+	Op_spill_rec_s *new_recs = mmap(NULL, sizeof(Op_spill_rec_s) * new_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, spill->fd, 0);
+
+	if(new_recs == MAP_FAILED){
+		return -1;
+	}
+
+	munmap(spill->recs, sizeof(Op_spill_rec_s) * spill->capacity);
+	spill->recs = new_recs;
+	spill->capacity = new_capacity;
+	return 0;
+}
+
+/* HELPER
+ * Moves a low process to the end of its queue's spill store. Its node is freed if the
+ * schedule owns it (owned), otherwise the record keeps pointing at it.
+ * Return 0 for success, -1 for error (the process is untouched)
+ */
+int spill_append(Op_queue_s *queue, Op_process_s *process, int owned){
+
+	Op_spill_s *spill = QUEUE_EXT(queue)->spill;
+	Op_process_ext_s *ext = PROC_EXT(process);
+
+	if(spill_make_room(spill) < 0){
+		return -1;
+	}
+
+	Op_spill_rec_s *rec = &spill->recs[spill->tail - spill->base];
+
+	rec->node = owned ? NULL : process;
+	rec->pid = process->pid;
+	rec->state = process->state;
+	rec->age = process->age;
+	rec->cmd_id = ext->cmd_id;
+	rec->gang = ext->gang;
+	rec->sched_class = ext->sched_class;
+	rec->bursts = ext->bursts;
+	rec->dead = 0;
+	rec->spill_tick = spill->ticks;
+	rec->run_total_ns = ext->run_total_ns;
+	rec->burst_avg_ns = ext->burst_avg_ns;
+	rec->quantum_ns = ext->quantum_ns;
+	rec->burst_run_ns = ext->burst_run_ns;
+
+	//tick it starves on: ages go up by 1 per tick and promote_queue promotes at MAX_AGE
+	int ticks_left = MAX_AGE - process->age;
+	unsigned long long due = spill->ticks + (ticks_left < 1 ? 1 : ticks_left);
+
+	spill->due[due % SPILL_DUE_SLOTS] = spill->tail + 1;
+	spill->tail++;
+	spill->count++;
+
+	if(owned){
+		free(process);
+	}
+	return 0;
+}
+
+/* HELPER
+ * Hands back the process of a spill record, its kept node or a new one rebuilt from
+ * the record, aged by the ticks it spent spilled.
+ * Returns NULL for error.
+ */
+Op_process_s *spill_restore(Op_spill_s *spill, Op_spill_rec_s *rec){
+
+	//node kept -> it still has everything but the ticks it aged meanwhile
+	if(rec->node != NULL){
+		rec->node->age += (int)(spill->ticks - rec->spill_tick);
+		return rec->node;
+	}
+
+	Op_process_s *process = malloc(sizeof(Op_process_ext_s));
+
+	if(process == NULL){
+		return NULL;
+	}
+
+	process->pid = rec->pid;
+	process->state = rec->state;
+	process->age = rec->age + (int)(spill->ticks - rec->spill_tick);
+	process->cmd = cmd_entries[rec->cmd_id].str;
+	process->next = NULL;
+
+	PROC_EXT(process)->cmd_id = rec->cmd_id;
+	PROC_EXT(process)->group = 0;
+	PROC_EXT(process)->gang = rec->gang;
+	PROC_EXT(process)->run_total_ns = rec->run_total_ns;
+	PROC_EXT(process)->burst_avg_ns = rec->burst_avg_ns;
+	PROC_EXT(process)->quantum_ns = rec->quantum_ns;
+	PROC_EXT(process)->bursts = rec->bursts;
+	PROC_EXT(process)->sched_class = rec->sched_class;
+	PROC_EXT(process)->burst_run_ns = rec->burst_run_ns;
+	PROC_EXT(process)->sjf_key = 0;
+	PROC_EXT(process)->sjf_seq = 0;
+
+	return process;
+}
+
+/* HELPER
+ * Gives back the pages of records that were paged in (the file keeps them, RSS doesn't).
+ * An empty store starts over at the front of its mapping.
+ */
+void spill_drop_pages(Op_spill_s *spill){
+
+	long page = sysconf(_SC_PAGESIZE);
+
+	if(spill->count == 0){
+		madvise(spill->recs, sizeof(Op_spill_rec_s) * spill->capacity, MADV_DONTNEED);
+		spill->base = spill->head = spill->dropped = spill->tail;
+		return;
+	}
+
+	//whole pages between the last drop and head
+	unsigned long long from = ((spill->dropped - spill->base) * sizeof(Op_spill_rec_s) + page - 1) / page * page;
+	unsigned long long to = (spill->head - spill->base) * sizeof(Op_spill_rec_s) / page * page;
+
+	if(to > from){
+		madvise((char *)spill->recs + from, to - from, MADV_DONTNEED);
+		spill->dropped = spill->head;
+	}
+}
+
+/* HELPER
+ * Pages spilled processes back in at the end of the queue's list, oldest first, while
+ * they are numbered below limit or the list holds fewer than want processes.
+ * Return 0 for success, -1 for error
+ */
+int spill_page_in(Op_queue_s *queue, unsigned long long limit, int want){
+
+	Op_spill_s *spill = QUEUE_EXT(queue)->spill;
+	int status = 0;
+
+	while(spill->head < spill->tail && (spill->head < limit || queue->count < want)){
+
+		Op_spill_rec_s *rec = &spill->recs[spill->head - spill->base];
+
+		if(!rec->dead){
+
+			Op_process_s *process = spill_restore(spill, rec);
+
+			if(process == NULL){
+				status = -1;
+				break;
+			}
+
+			append_queue(queue, process);
+			spill->count--;
+		}
+
+		spill->head++;
+	}
+
+	spill_drop_pages(spill);
+	return status;
+}
+
+/* HELPER
+ * Call once per op_promote_processes, before the queue is aged: pages in everything
+ * up to the last spilled process that starves on this tick, so promote_queue sees it.
+ */
+void spill_tick(Op_queue_s *queue){
+
+	Op_spill_s *spill = QUEUE_EXT(queue)->spill;
+
+	if(spill == NULL){
+		return;
+	}
+
+	unsigned int slot = (spill->ticks + 1) % SPILL_DUE_SLOTS;
+	unsigned long long limit = spill->due[slot];
+
+	spill->due[slot] = 0;
+
+	if(spill->count > 0){
+		spill_page_in(queue, limit, 0);
+	}
+
+	spill->ticks++;
+}
+
+/* HELPER
+ * Once the list of a spilling queue is down to half its window, pages the next batch
+ * of spilled processes in to fill it back up.
+ */
+void spill_refill(Op_queue_s *queue){
+
+	Op_spill_s *spill = QUEUE_EXT(queue)->spill;
+
+	if(spill == NULL || spill->count == 0 || queue->count > spill->window / 2){
+		return;
+	}
+
+	spill_page_in(queue, 0, spill->window);
+}
+
+/* HELPER
+ * Removes the spilled process with the given pid (leaves a dead record behind).
+ * Returns NULL if it isn't spilled.
+ */
+Op_process_s *spill_take(Op_queue_s *queue, pid_t pid){
+
+	Op_spill_s *spill = QUEUE_EXT(queue)->spill;
+
+	if(spill == NULL){
+		return NULL;
+	}
+
+	for(unsigned long long number = spill->head; number < spill->tail; number++){
+
+		Op_spill_rec_s *rec = &spill->recs[number - spill->base];
+
+		if(rec->dead || rec->pid != pid){
+			continue;
+		}
+
+		Op_process_s *process = spill_restore(spill, rec);
+
+		if(process != NULL){
+			process->age = 0;
+			rec->dead = 1;
+			spill->count--;
+			spill_drop_pages(spill);
+		}
+		return process;
+	}
+
+	return NULL;
+}
+
+/* HELPER
+ * Releases everything still spilled and unmaps the store.
+ */
+void spill_destroy(Op_spill_s *spill){
+
+	for(unsigned long long number = spill->head; number < spill->tail; number++){
+		if(!spill->recs[number - spill->base].dead){
+			release_cmd(spill->recs[number - spill->base].cmd_id);
+			free(spill->recs[number - spill->base].node);
+		}
+	}
+
+	munmap(spill->recs, sizeof(Op_spill_rec_s) * spill->capacity);
+	close(spill->fd);
+	free(spill);
+}
+
+/* HELPER
+ * Writes one columnar batch (see op_export.h): header, the pid, exit code and
+ * command id columns, then the commands the batch uses. marks[id] == batch
+ * means the command is already in this batch's dictionary.
+ * Return 0 for success, -1 for error
+ */
+int export_columns(FILE *out, Op_export_buf_s *buf, int count, unsigned int *marks, unsigned int batch){
+
+	Op_export_batch_s header;
+	uint32_t dict_count = 0;
+
+	//columns first, counting the distinct commands on the way
+	for(int i = 0; i < count; i++){
+
+		unsigned int cmd_id = PROC_EXT(buf->procs[i])->cmd_id;
+
+		buf->pids[i] = buf->procs[i]->pid;
+		buf->codes[i] = buf->procs[i]->state & STATE_FLAG;
+		buf->cmd_ids[i] = cmd_id;
+
+		if(marks[cmd_id] != batch){
+			marks[cmd_id] = batch;
+			dict_count++;
+		}
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OP_EXPORT_MAGIC, sizeof(header.magic));
+	header.version = OP_EXPORT_VERSION;
+	header.count = count;
+	header.dict_count = dict_count;
+
+	if(fwrite(&header, sizeof(header), 1, out) != 1 ||
+		fwrite(buf->pids, sizeof(int32_t), count, out) != (size_t)count ||
+		fwrite(buf->codes, sizeof(uint32_t), count, out) != (size_t)count ||
+		fwrite(buf->cmd_ids, sizeof(uint32_t), count, out) != (size_t)count){
+		return -1;
+	}
+
+	//dictionary: each command once, in order of first use (marks flip to ~batch once written)
+	for(int i = 0; i < count; i++){
+
+		unsigned int cmd_id = buf->cmd_ids[i];
+
+		if(marks[cmd_id] != batch){
+			continue;
+		}
+		marks[cmd_id] = ~batch;
+
+		Op_export_dict_s entry;
+
+		entry.cmd_id = cmd_id;
+		entry.len = strlen(cmd_entries[cmd_id].str);
+
+		if(fwrite(&entry, sizeof(entry), 1, out) != 1 || fwrite(cmd_entries[cmd_id].str, 1, entry.len, out) != entry.len){
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* HELPER
+ * Appends bytes to the csv buffer, handing it to out whenever it fills up.
+ * Return 0 for success, -1 for error
+ */
+int export_put(FILE *out, Op_export_buf_s *buf, const char *data, size_t len){
+
+	while(len > 0){
+
+		if(buf->csv_used == EXPORT_BUFFER){
+
+			if(fwrite(buf->csv, 1, buf->csv_used, out) != buf->csv_used){
+				return -1;
+			}
+			buf->csv_used = 0;
+		}
+
+		size_t chunk = EXPORT_BUFFER - buf->csv_used < len ? EXPORT_BUFFER - buf->csv_used : len;
+
+		memcpy(buf->csv + buf->csv_used, data, chunk);
+		buf->csv_used += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+/* HELPER
+ * Writes one batch as "pid,exit_code,cmd" lines into the csv buffer
+ * (numbers are formatted by hand, printf would dominate the cost).
+ * Return 0 for success, -1 for error
+ */
+int export_csv(FILE *out, Op_export_buf_s *buf, int count){
+
+	for(int i = 0; i < count; i++){
+
+		Op_process_s *process = buf->procs[i];
+		char line[32];
+		char *end = line + sizeof(line);
+		char *start = end;
+
+		//"pid,exit_code," built backwards
+		*--start = ',';
+		unsigned int code = process->state & STATE_FLAG;
+		do{
+			*--start = '0' + code % 10;
+			code /= 10;
+		} while(code != 0);
+
+		*--start = ',';
+		long long pid = process->pid;
+		unsigned long long digits = pid < 0 ? -(unsigned long long)pid : (unsigned long long)pid;
+		do{
+			*--start = '0' + digits % 10;
+			digits /= 10;
+		} while(digits != 0);
+		if(pid < 0){
+			*--start = '-';
+		}
+
+		if(export_put(out, buf, start, end - start) < 0){
+			return -1;
+		}
+
+		//command, quoted only when it has to be
+		const char *cmd = process->cmd;
+		size_t len = strlen(cmd);
+
+		if(strpbrk(cmd, ",\"\n\r") == NULL){
+			if(export_put(out, buf, cmd, len) < 0){
+				return -1;
+			}
+		}
+		else{
+			if(export_put(out, buf, "\"", 1) < 0){
+				return -1;
+			}
+
+			for(const char *quote; (quote = strchr(cmd, '"')) != NULL; cmd = quote + 1){
+				if(export_put(out, buf, cmd, quote - cmd + 1) < 0 || export_put(out, buf, "\"", 1) < 0){
+					return -1;
+				}
+			}
+
+			if(export_put(out, buf, cmd, strlen(cmd)) < 0 || export_put(out, buf, "\"", 1) < 0){
+				return -1;
+			}
+		}
+
+		if(export_put(out, buf, "\n", 1) < 0){
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* HELPER
+ * Puts a group at the back of the round (just before the group whose turn it is)
+ * unless it is already waiting for a turn.
+ */
+void group_activate(Op_schedule_s *schedule, int id){
+
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+	Op_group_s *group = &ext->groups[id];
+
+	if(group->next >= 0){
+		return;
+	}
+
+	//first group with work -> it's the whole round
+	if(ext->group_current < 0){
+		group->prev = id;
+		group->next = id;
+		ext->group_current = id;
+		return;
+	}
+
+	Op_group_s *current = &ext->groups[ext->group_current];
+
+	group->next = ext->group_current;
+	group->prev = current->prev;
+	ext->groups[current->prev].next = id;
+	current->prev = id;
+}
+
+/* HELPER
+ * Takes a group out of the round, passing the turn on if it was the group's.
+ */
+void group_deactivate(Op_schedule_s *schedule, int id){
+
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+	Op_group_s *group = &ext->groups[id];
+
+	if(group->next < 0){
+		return;
+	}
+
+	if(group->next == id){
+		ext->group_current = -1;
+	}
+	else{
+		ext->groups[group->prev].next = group->next;
+		ext->groups[group->next].prev = group->prev;
+
+		if(ext->group_current == id){
+			ext->group_current = group->next;
+		}
+	}
+
+	group->next = -1;
+	group->prev = -1;
+	group->deficit = 0;
+}
+
+/* HELPER
+ * True if a group has ready processes: in its queues, or in the SJF heap for group 0.
+ */
+int group_ready(Op_schedule_s *schedule, int id){
+
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+
+	return op_get_count(ext->groups[id].high) > 0 || op_get_count(ext->groups[id].low) > 0 ||
+		(id == 0 && ext->sjf_count > 0);
+}
+
+/* HELPER
+ * Returns the group whose turn it is (starting the turn if it hasn't started), dropping groups
+ * that drained since their last turn (selects/terminations that bypass op_select).
+ * Returns -1 when no group has ready processes.
+ */
+int group_turn(Op_schedule_s *schedule){
+
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+
+	while(ext->group_current >= 0){
+
+		int id = ext->group_current;
+
+		if(!group_ready(schedule, id)){
+			group_deactivate(schedule, id);
+			continue;
+		}
+
+		if(ext->groups[id].deficit <= 0){
+			ext->groups[id].deficit = ext->groups[id].shares;
+		}
+		return id;
+	}
+
+	return -1;
+}
+
+/* HELPER
+ * Returns the first group, in round order from the one whose turn it is, with a critical
+ * process in its high queue, or -1 for none.
+ */
+int group_crit(Op_schedule_s *schedule){
+
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+	int id = ext->group_current;
+
+	if(!OP_FEATURE_CRITICAL || id < 0){
+		return -1;
+	}
+
+	do{
+		Op_queue_s *high = ext->groups[id].high;
+
+		if(QUEUE_BOOKKEEPING ? QUEUE_EXT(high)->crit_count > 0 : first_crit_pos(high) >= 0){
+			return id;
+		}
+		id = ext->groups[id].next;
+	}while(id != ext->group_current);
+
+	return -1;
+}
+
+/* HELPER
+ * Removes the next process of a group: its classes (high queue, SJF heap for group 0, low queue)
+ * take turns by their weights, each pick spending one credit of its class. Credits are per
+ * group and are topped up once none of the classes with processes has any left. A class with a
+ * weight of 0 only gets picked when no weighted class has processes (high before SJF before low),
+ * and a lone class is picked without spending credit.
+ * Returns NULL if the group has no ready processes.
+ */
+Op_process_s *group_pick(Op_schedule_s *schedule, int id){
+
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+	Op_group_s *group = &ext->groups[id];
+
+	int *credit[SELECT_CLASSES] = { &group->high_credit, &group->sjf_credit, &group->low_credit };
+	int weight[SELECT_CLASSES] = { ext->high_weight, ext->sjf_weight, ext->low_weight };
+	int ready[SELECT_CLASSES] = { op_get_count(group->high) > 0, id == 0 && ext->sjf_count > 0, op_get_count(group->low) > 0 };
+	int ready_count = 0;
+	int first = -1;
+	int pick = -1;
+
+	for(int class = 0; class < SELECT_CLASSES; class++){
+		if(ready[class]){
+			ready_count++;
+			first = first < 0 ? class : first;
+			pick = pick < 0 && *credit[class] > 0 ? class : pick;
+		}
+	}
+
+	if(ready_count == 0){
+		return NULL;
+	}
+
+	//nothing to weigh unless several classes have processes
+	if(ready_count == 1){
+		pick = first;
+	}
+	else{
+
+		//round used up -> next round
+		if(pick < 0){
+			for(int class = 0; class < SELECT_CLASSES; class++){
+				*credit[class] = weight[class];
+				pick = pick < 0 && ready[class] && *credit[class] > 0 ? class : pick;
+			}
+		}
+
+		//only unweighted classes have processes
+		if(pick < 0){
+			pick = first;
+		}
+		else{
+			(*credit[pick])--;
+		}
+	}
+
+	Op_process_s *selected;
+
+	if(pick == SELECT_HIGH){
+		selected = select_high_queue(group->high);
+		check_capacity(schedule, group->high);
+		trace_op(schedule, OP_TRACE_SELECT, selected, OP_TRACE_Q_HIGH);
+	}
+	else if(pick == SELECT_SJF){
+		selected = sjf_remove(ext, 0);
+		trace_op(schedule, OP_TRACE_SELECT, selected, OP_TRACE_Q_SJF);
+	}
+	else{
+		selected = remove_from_front(group->low);
+		check_capacity(schedule, group->low);
+		trace_op(schedule, OP_TRACE_SELECT, selected, OP_TRACE_Q_LOW);
+	}
+
+	return selected;
+}
+
+/*
+ * Deallocates the contents of a queue.
+ */
+void dealloc_queue(Op_queue_s *queue){
+
+	if(queue == NULL){
+		return;
+	}
+
+	//spilled processes only hold their command reference and the mapping
+	if(QUEUE_EXT(queue)->spill != NULL){
+		spill_destroy(QUEUE_EXT(queue)->spill);
+	}
+
+	Op_process_s *walker = NULL; //copy of the head
+	Op_process_s *dead_process = NULL; //process being freed
+
+	walker = queue->head;
+
+	while(walker != NULL){
+
+		release_cmd(PROC_EXT(walker)->cmd_id); //drop dead_process' reference on its shared command
+		walker->cmd = NULL; // avoid dangling pointer
+		dead_process = walker; //save pointer to dead process
+		walker= walker->next; //go to next node
+		free(dead_process); //free dead_process
+	}
+
+	//free(queue->head); //free memory for queue head
+	queue->head = NULL;//make sure there's no dangling pointer
+	
+	free(queue); //free memory for queue
+	queue = NULL; //set memory address of freed queue to be NULL
+}
+
+
+/*
+ * Dynamically allocates memory for a schedule and its queues.
+ * Return a pointer to the schedule created or NULL for error.
+ */
+Op_schedule_s *op_create() {
+
+	//make sched point to null (override garbage value)	
+	Op_schedule_s *sched = NULL;
+
+	//dynamically allocate memory for schedule (wrapper holds the scheduler-wide state too)
+	sched = malloc(sizeof(Op_schedule_ext_s));
+
+	//NULL return -> ERROR
+	if(sched == NULL){
+		return NULL;
+	}
+
+	//no admission limits and nobody to notify until the caller asks for them
+	SCHED_EXT(sched)->capacity_cb = NULL;
+	SCHED_EXT(sched)->capacity_arg = NULL;
+	SCHED_EXT(sched)->capacity_fd = -1;
+
+	//tracing stays off until op_trace_enable
+	SCHED_EXT(sched)->trace_ring = NULL;
+	SCHED_EXT(sched)->trace_mask = 0;
+	SCHED_EXT(sched)->trace_head = 0;
+	
+	//dynamically allocate memory for high queue
+	sched->ready_queue_high = queue_create(sched->ready_queue_high);
+        if(sched->ready_queue_high == NULL){
+                return NULL;
+        }
+
+	//dynamically allocate memory for low queue
+	sched->ready_queue_low = queue_create(sched->ready_queue_low);
+        if(sched->ready_queue_low == NULL){
+                return NULL;
+        }
+
+
+	//dynamically allocate memory for defunct queue	
+	sched->defunct_queue = queue_create(sched->defunct_queue);
+	if(sched->defunct_queue == NULL){
+		return NULL;
+	} 
+
+	//group 0 schedules ungrouped processes through the schedule's own queues
+	Op_group_s *group = &SCHED_EXT(sched)->groups[0];
+
+	memset(group, 0, sizeof(Op_group_s));
+	group->high = sched->ready_queue_high;
+	group->low = sched->ready_queue_low;
+	group->shares = 1;
+	group->prev = -1;
+	group->next = -1;
+	SCHED_EXT(sched)->group_count = 1;
+	SCHED_EXT(sched)->group_current = -1;
+
+	//SJF heap grows on first use
+	SCHED_EXT(sched)->sjf_heap = NULL;
+	SCHED_EXT(sched)->sjf_count = 0;
+	SCHED_EXT(sched)->sjf_capacity = 0;
+	SCHED_EXT(sched)->sjf_seq = 0;
+
+	//op_select: high first, low only when high is empty, until op_set_select_ratio
+	//(the SJF heap gets as many turns as the high queue, until op_set_sjf_weight)
+	SCHED_EXT(sched)->high_weight = 1;
+	SCHED_EXT(sched)->low_weight = 0;
+	SCHED_EXT(sched)->sjf_weight = 1;
+
+	//gang mark table is made by the first promote_queue pass
+	SCHED_EXT(sched)->gang_marks = NULL;
+	SCHED_EXT(sched)->gang_mark_mask = 0;
+	SCHED_EXT(sched)->gang_stamp = 0;
+
+	return sched;
+}
+
+
+/*
+ * dynamically allocate memory for a process and initialize its fields
+ *	-dynamically allocate memory for the command
+ *	-set ready bit to 1, defunct bit to 0
+ *	-is_low and is_critical determine if low and critical bits should be on or off
+ *	-remaining 28 bits are set to 0
+ * return NULL for error
+ */ 	
+Op_process_s *op_new_process(char *command, pid_t pid, int is_low, int is_critical) {
+
+	//return NULL for error if command is null
+	if(command == NULL){
+		return NULL;
+	}
+	
+	//override garbage value of process we are creating with NULL
+	Op_process_s *process = NULL;
+
+	//dynamically allocate memory for the process (wrapper holds the runtime accounting too)
+	process = malloc(sizeof(Op_process_ext_s));
+	
+	//NULL malloc -> ERROR
+	if(process == NULL) {
+		return NULL;
+	}		
+
+	//share one copy of the command between every process that runs it
+	int cmd_id = intern_cmd(command);
+	
+	//intern failure -> ERROR
+	if(cmd_id < 0){
+		free(process);
+		return NULL;
+	}
+	
+	PROC_EXT(process)->cmd_id = cmd_id;
+	process->cmd = cmd_entries[cmd_id].str;
+		
+	process->pid = pid; //initialize id to provided id
+	process->age = 0; //initialize age to 0
+	process->next = NULL; //next to NULL
+
+	process->state = 0 | READY_FLAG; //initialize all state bits to be off except for ready bit	
+
+	//ungrouped and not in a gang until op_set_group/op_set_gang
+	PROC_EXT(process)->group = 0;
+	PROC_EXT(process)->gang = 0;
+
+	//no cpu time charged yet, start with the base time slice
+	PROC_EXT(process)->run_total_ns = 0;
+	PROC_EXT(process)->burst_avg_ns = 0;
+	PROC_EXT(process)->quantum_ns = BASE_QUANTUM_NS;
+	PROC_EXT(process)->bursts = 0;
+
+	//FIFO class until op_set_class
+	PROC_EXT(process)->sched_class = OP_CLASS_FIFO;
+	PROC_EXT(process)->burst_run_ns = 0;
+	PROC_EXT(process)->sjf_key = 0;
+	PROC_EXT(process)->sjf_seq = 0;
+
+	//return null for error is process if low and critical (or asks for a lane this build doesn't have)
+	if((is_low && is_critical) || (is_low && !OP_FEATURE_LOW) || (is_critical && !OP_FEATURE_CRITICAL)){
+		release_cmd(cmd_id);
+		free(process);
+		return NULL;
+	}
+
+	//initialize low and critical bits to match function input
+	else if(is_low){
+		set_state_on(process, LOW_FLAG);
+	}
+
+	else if(is_critical){
+		set_state_on(process, CRITICAL_FLAG);
+	}
+	
+	return process; //return pointer to the process being created
+}
+
+/*
+ * Frees a process that isn't in any queue (never added, or handed out by an op_select*
+ * and not added back) and drops its reference on its interned command.
+ */
+void op_free_process(Op_process_s *process){
+
+	if(process == NULL){
+		return;
+	}
+
+	release_cmd(PROC_EXT(process)->cmd_id);
+	free(process);
+}
+
+
+/*
+ * HELPER
+ * op_add and op_add_owned: owned says whether the schedule may free the process's node
+ * when it spills.
+ */
+int add_process(Op_schedule_s *schedule, Op_process_s *process, int owned) {
+
+	
+	//S1: check for invalid arguments
+	if(schedule == NULL || process == NULL) {
+		return -1;
+	}
+
+	//S2: set ready bit ON, defunct bit OFF, next pointer to NULL
+	set_state_on(process, READY_FLAG);
+	unset_state(process, DEFUNCT_FLAG);
+	process->next = NULL;
+	
+	//unknown group -> ERROR
+	unsigned int group_id = PROC_EXT(process)->group;
+
+	if(group_id >= (unsigned int)SCHED_EXT(schedule)->group_count){
+		return -1;
+	}
+
+	//SJF class goes in the heap (critical processes still go to the high queue so they stay first)
+	if(PROC_EXT(process)->sched_class == OP_CLASS_SJF && !check_crit(process)){
+
+		Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+		Op_process_ext_s *proc = PROC_EXT(process);
+		unsigned long long predicted = cmd_entries[proc->cmd_id].stats.burst_avg_ns;
+
+		//SJF processes are ungrouped
+		if(group_id != 0){
+			return -1;
+		}
+
+		//no completed burst for this command yet -> assume a full quantum
+		if(predicted == 0){
+			predicted = BASE_QUANTUM_NS;
+		}
+
+		//predicted remaining time: whatever the unfinished burst hasn't used of the prediction
+		//(never 0, that key is for processes that reached MAX_AGE)
+		proc->sjf_key = predicted > proc->burst_run_ns ? predicted - proc->burst_run_ns : 1;
+		proc->sjf_seq = ext->sjf_seq++;
+
+		if(sjf_push(ext, process) < 0){
+			return -1;
+		}
+
+		//the heap takes its turns with group 0's queues
+		STAT_INC(ext->groups[0].stats.added);
+		group_activate(schedule, 0);
+
+		trace_op(schedule, OP_TRACE_ADD, process, OP_TRACE_Q_SJF);
+		return 0;
+	}
+
+	Op_group_s *group = &SCHED_EXT(schedule)->groups[group_id];
+
+	/*
+	* S3-4: check low bit to determine which
+	* queue to add process to and add it to that queue
+	*/
+	Op_queue_s *queue = check_low(process) ? group->low : group->high;
+	Op_watermark_s *limits = &QUEUE_EXT(queue)->limits;
+
+	//admission control: full queues throttle until drained, critical processes dip into the reserve
+	if(limits->high_mark > 0){
+
+		int count = op_get_count(queue);
+
+		if(count >= limits->high_mark){
+			limits->throttled = 1;
+		}
+
+		if(check_crit(process) ? count >= limits->high_mark + limits->reserve : limits->throttled){
+			trace_op(schedule, OP_TRACE_THROTTLED, process, OP_TRACE_Q_NONE);
+			return OP_THROTTLED;
+		}
+	}
+
+	//spilling queue past its window -> the process goes to the spill store, which may free it (so trace it first)
+	Op_spill_s *spill = QUEUE_EXT(queue)->spill;
+	int spilling = spill != NULL && (queue->count >= spill->window || spill->count > 0);
+
+	//reserve the store slot before committing: once room is made spill_append can't fail
+	if(spilling && spill_make_room(spill) < 0){
+
+		//older processes are spilled -> listing this one would run it ahead of them
+		if(spill->count > 0){
+			return -1;
+		}
+
+		//nothing spilled yet -> it can stay in the list without breaking FIFO
+		spilling = 0;
+	}
+
+	if(!spilling && append_queue(queue, process) < 0){
+		return -1;
+	}
+
+	STAT_INC(group->stats.added);
+	group_activate(schedule, group_id);
+
+	trace_op(schedule, OP_TRACE_ADD, process, check_low(process) ? OP_TRACE_Q_LOW : OP_TRACE_Q_HIGH);
+
+	if(spilling){
+		spill_append(queue, process, owned);
+	}
+	return 0;
+}
+
+/*
+ * First initializes ready bit of process to 1 and defunct bit to 0 (without changing critical or low bits)
+ * Then appends a process to the queue corresponding to its low priority bit (update queue head if necessary)
+ *	- 1 = low queue
+ * 	- 0 = high queue
+ * Grouped processes go to their group's queues instead of the schedule's.
+ *
+ * If that queue is over its watermark the process is NOT added (caller keeps it)
+ * unless it is critical and the queue's reserve still has room.
+ *
+ * The caller's pointer stays valid: a process that spills (op_set_spill) keeps its node and
+ * the same pointer is handed back later.
+ *
+ * return 0 for success, -1 for error, OP_THROTTLED if the queue is full
+ */
+int op_add(Op_schedule_s *schedule, Op_process_s *process) {
+
+	return add_process(schedule, process, 0);
+}
+
+/*
+ * Same as op_add, but on success the schedule owns the process: if it spills its node is
+ * freed (only its record stays, in the spill store's file), so the caller must not use the
+ * pointer again. The one op_select* hands back later may be a new allocation with the same
+ * contents. On failure the caller still owns it.
+ * This is what keeps a spilling queue's processes out of the heap.
+ *
+ * return 0 for success, -1 for error, OP_THROTTLED if the queue is full
+ */
+int op_add_owned(Op_schedule_s *schedule, Op_process_s *process) {
+
+	return add_process(schedule, process, 1);
+}
+
+/*
+ * Sets the admission limits of one of the schedule's ready queues, ungrouped (ready_queue_high/low)
+ * or a group's (op_get_group_queue).
+ * -high_mark of 0 removes the limits
+ * -low_mark must be below high_mark, reserve can't be negative
+ *
+ * Return 0 for success, -1 for error
+ */
+int op_set_watermarks(Op_schedule_s *schedule, Op_queue_s *queue, int high_mark, int low_mark, int reserve){
+
+	if(schedule == NULL || queue == NULL){
+		return -1;
+	}
+
+	Op_watermark_s *limits = queue_limits(schedule, queue);
+
+	if(limits == NULL || high_mark < 0 || reserve < 0 || (high_mark > 0 && (low_mark < 0 || low_mark >= high_mark))){
+		return -1;
+	}
+
+	limits->high_mark = high_mark;
+	limits->low_mark = low_mark;
+	limits->reserve = reserve;
+
+	//new limits might already be satisfied
+	check_capacity(schedule, queue);
+
+	return 0;
+}
+
+/*
+ * Registers a callback run when a throttled ready queue drains to its low watermark
+ * (NULL cb to remove it).
+ *
+ * Return 0 for success, -1 for error
+ */
+int op_set_capacity_cb(Op_schedule_s *schedule, Op_capacity_cb cb, void *arg){
+
+	if(schedule == NULL){
+		return -1;
+	}
+
+	SCHED_EXT(schedule)->capacity_cb = cb;
+	SCHED_EXT(schedule)->capacity_arg = arg;
+	return 0;
+}
+
+/*
+ * Registers an eventfd that gets bumped when a throttled ready queue drains
+ * to its low watermark (-1 to remove it). The schedule doesn't own the fd.
+ *
+ * Return 0 for success, -1 for error
+ */
+int op_set_capacity_fd(Op_schedule_s *schedule, int fd){
+
+	if(schedule == NULL){
+		return -1;
+	}
+
+	SCHED_EXT(schedule)->capacity_fd = fd;
+	return 0;
+}
+
+
+/*
+ * Returns number of process in designated queue or -1 if queue is NULL
+ */
+int op_get_count(Op_queue_s *queue){
+
+
+	if(queue == NULL){
+		return -1;
+	}
+
+	//spilled processes are still in the queue
+	if(QUEUE_EXT(queue)->spill != NULL){
+		return queue->count + QUEUE_EXT(queue)->spill->count;
+	}
+
+	return queue->count;
+}
+
+
+/*
+ * Removes and returns pointer to the first critical process in the high queue.
+ * If there are no critical processes, perform same actions on first process instead.
+ * -removed processes have their ages set to 0 and next pointers set to NULL
+ *
+ * Return NULL if queue is empty.
+ */
+Op_process_s *op_select_high(Op_schedule_s *schedule){
+
+	//check if schedule is NULL or queue is empty
+	if(schedule == NULL || op_get_count(schedule->ready_queue_high) <= 0){
+		return NULL;
+	}
 	
-	//go through all processes in low queue
-	while(walker != NULL){
+	//critical processes first, otherwise the first process
+	Op_process_s *selected = select_high_queue(schedule->ready_queue_high);
+
+	check_capacity(schedule, schedule->ready_queue_high);
+	trace_op(schedule, OP_TRACE_SELECT, selected, OP_TRACE_Q_HIGH);
+	return selected;
+}
+
+/*
+ * Removes and returns pointer to first process in the low queue.
+ * Almost dentical to op_select_high but 
+ * LOW QUEUE WILL NOT HAVE CRITICAL PROCESSES!
+ *
+ * Return NULL for error.
+ */
+Op_process_s *op_select_low(Op_schedule_s *schedule){
+
+	if(schedule == NULL){
+		return NULL;
+	}
+	
+ 	Op_process_s *selected = remove_from_front(schedule->ready_queue_low);
+
+	check_capacity(schedule, schedule->ready_queue_low);
+	trace_op(schedule, OP_TRACE_SELECT, selected, OP_TRACE_Q_LOW);
+	return selected;
+}
+
+/*
+ * Sets the ratio op_select dispatches the high and low queues at: every round of a
+ * group hands out high_weight high processes and low_weight low ones (interleaved high first).
+ * A low_weight of 0 means low processes only run when the high queue is empty.
+ * Starts a new round in every group.
+ *
+ * Return 0 for success, -1 for error
+ */
+int op_set_select_ratio(Op_schedule_s *schedule, int high_weight, int low_weight){
+
+	if(schedule == NULL || high_weight < 0 || low_weight < 0 || high_weight + low_weight == 0){
+		return -1;
+	}
+
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+
+	ext->high_weight = high_weight;
+	ext->low_weight = low_weight;
+
+	for(int group = 0; group < ext->group_count; group++){
+		ext->groups[group].high_credit = 0;
+		ext->groups[group].sjf_credit = 0;
+		ext->groups[group].low_credit = 0;
+	}
+	return 0;
+}
+
+/*
+ * Sets how many SJF class processes op_select hands out per round of the ungrouped
+ * processes, next to the high_weight high and low_weight low ones (op_set_select_ratio).
+ * SJF picks come after the high ones and before the low ones in a round.
+ * A weight of 0 means SJF processes only run when the high queue is empty (or also unweighted).
+ * Starts a new round in every group.
+ *
+ * Return 0 for success, -1 for error
+ */
+int op_set_sjf_weight(Op_schedule_s *schedule, int sjf_weight){
+
+	if(schedule == NULL || sjf_weight < 0){
+		return -1;
+	}
+
+	SCHED_EXT(schedule)->sjf_weight = sjf_weight;
+	return op_set_select_ratio(schedule, SCHED_EXT(schedule)->high_weight, SCHED_EXT(schedule)->low_weight);
+}
+
+/*
+ * Removes and returns the next ready process of the schedule, from any group or class:
+ * -a critical process always goes first (the first group in round order that has one)
+ * -otherwise the groups take turns deficit round robin style, each turn is shares dispatches
+ *  (op_group_create, ungrouped processes are group 0 with 1 share)
+ * -within a group the high queue, the SJF heap (group 0 only) and the low queue take turns
+ *  by their weights (op_set_select_ratio, op_set_sjf_weight): each pick spends one credit of
+ *  its class, they are topped up once the classes with processes have none left
+ * -when only one class has processes it is picked without spending credit
+ * Each decision only reads counters, the queues are searched only by the pick itself.
+ * -removed processes have their ages set to 0 and next pointers set to NULL
+ *
+ * Return NULL if nothing is ready.
+ */
+Op_process_s *op_select(Op_schedule_s *schedule){
+
+	if(schedule == NULL){
+		return NULL;
+	}
+
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+	Op_process_s *selected;
+	int id = group_crit(schedule);
+
+	//critical processes don't wait for their group's turn (or spend it)
+	if(id >= 0){
+
+		Op_group_s *group = &ext->groups[id];
+
+		selected = select_high_queue(group->high);
+		check_capacity(schedule, group->high);
+		trace_op(schedule, OP_TRACE_SELECT, selected, OP_TRACE_Q_HIGH);
+		STAT_INC(group->stats.dispatched);
+
+		if(!group_ready(schedule, id)){
+			group_deactivate(schedule, id);
+		}
+		return selected;
+	}
+
+	id = group_turn(schedule);
+
+	if(id < 0){
+		return NULL;
+	}
+
+	Op_group_s *group = &ext->groups[id];
+
+	selected = group_pick(schedule, id);
+	STAT_INC(group->stats.dispatched);
+	group->deficit--;
+
+	//group out of work -> leave the round, out of dispatches -> pass the turn on
+	if(!group_ready(schedule, id)){
+		group_deactivate(schedule, id);
+	}
+	else if(group->deficit <= 0){
+		ext->group_current = group->next;
+	}
+
+	return selected;
+}
+
+/*
+ * Charges a process for ns nanoseconds of cpu time after it was dispatched.
+ * -adds ns to the cumulative runtime and folds it into the averaged burst length
+ * -a charge shorter than the quantum ends the current cpu burst, whose total length
+ *  updates the command's predicted burst (used to order the SJF class)
+ * -a process that used its whole time slice is a cpu hog: its quantum is halved (down to MIN_QUANTUM_NS)
+ *  while it is in the high queue; a hog in the low queue is batch work and keeps BASE_QUANTUM_NS,
+ *  shorter slices there would only multiply its dispatches
+ * -a process whose bursts average well under its quantum is interactive: its quantum grows
+ *  back toward BASE_QUANTUM_NS and its low bit is cleared so op_add puts it in the high queue
+ *
+ * Return 0 for success, -1 for error
+ */
+int op_charge(Op_process_s *process, unsigned long long ns){
+
+	if(process == NULL){
+		return -1;
+	}
+
+	Op_process_ext_s *ext = PROC_EXT(process);
+
+	ext->run_total_ns += ns;
+
+	//same charge goes to the command's aggregate
+	if(OP_FEATURE_STATS){
+		cmd_entries[ext->cmd_id].stats.run_total_ns += ns;
+		cmd_entries[ext->cmd_id].stats.bursts++;
+	}
+
+	//a burst ends when the process gives up the cpu before its quantum runs out,
+	//completed bursts feed the command's prediction the SJF class orders by
+	ext->burst_run_ns += ns;
+
+	if(ns < ext->quantum_ns){
+
+		Op_cmd_stats_s *cmd = &cmd_entries[ext->cmd_id].stats;
+
+		if(cmd->burst_avg_ns == 0){
+			cmd->burst_avg_ns = ext->burst_run_ns;
+		}
+		else{
+			cmd->burst_avg_ns = cmd->burst_avg_ns - (cmd->burst_avg_ns >> BURST_SHIFT) + (ext->burst_run_ns >> BURST_SHIFT);
+		}
+		ext->burst_run_ns = 0;
+	}
+
+	//first burst seeds the average, later ones move it by 1/(2^BURST_SHIFT) of the difference
+	if(ext->bursts == 0){
+		ext->burst_avg_ns = ns;
+	}
+	else{
+		ext->burst_avg_ns = ext->burst_avg_ns - (ext->burst_avg_ns >> BURST_SHIFT) + (ns >> BURST_SHIFT);
+	}
+	ext->bursts++;
+
+	//cpu hog -> ran until preempted, give it a shorter slice next time (batch hogs keep the full one)
+	if(ns >= ext->quantum_ns){
+
+		if(check_low(process)){
+			ext->quantum_ns = BASE_QUANTUM_NS;
+		}
+		else{
+			ext->quantum_ns >>= 1;
+			if(ext->quantum_ns < MIN_QUANTUM_NS){
+				ext->quantum_ns = MIN_QUANTUM_NS;
+			}
+		}
+	}
+
+	//short bursts -> restore the slice and boost toward the high queue
+	else if(ext->burst_avg_ns < (ext->quantum_ns >> INTERACTIVE_SHIFT)){
+
+		ext->quantum_ns <<= 1;
+		if(ext->quantum_ns > BASE_QUANTUM_NS){
+			ext->quantum_ns = BASE_QUANTUM_NS;
+		}
+		unset_state(process, LOW_FLAG);
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the time slice (in ns) the dispatcher should give this process next,
+ * or 0 if process is NULL.
+ */
+unsigned long long op_get_quantum(Op_process_s *process){
+
+	if(process == NULL){
+		return 0;
+	}
+
+	return PROC_EXT(process)->quantum_ns;
+}
+
+/*
+ * Returns the intern table id of the process' command (0 if process is NULL).
+ */
+unsigned int op_get_cmd_id(Op_process_s *process){
+
+	if(process == NULL){
+		return 0;
+	}
+
+	return PROC_EXT(process)->cmd_id;
+}
+
+/*
+ * Copies the aggregated stats of every live process sharing the command with the given id.
+ * Return 0 for success, -1 for error (unknown id or NULL stats)
+ */
+int op_cmd_stats(unsigned int cmd_id, Op_cmd_stats_s *stats){
+
+	if(stats == NULL || cmd_id >= cmd_used || cmd_entries[cmd_id].str == NULL){
+		return -1;
+	}
+
+	*stats = cmd_entries[cmd_id].stats;
+	stats->processes = cmd_entries[cmd_id].refs;
+	return 0;
+}
+
+/*
+ * Increases ages of all processes in low queue by 1.
+ * Any processes with ages 5 or greater are removed from low queue and appended to high queue.
+ * -removed processes have their ages set to 0 and their next pointers set to NULL
+ *
+ * Return 0 for success, -1 for errors
+ */
+int op_promote_processes(Op_schedule_s *schedule){
+	
+        //check if schedule is NULL, low queue is empty, or high queue is NULL
+        if(schedule == NULL || schedule->ready_queue_high == NULL){
+                return -1;
+        }
+	
+	//no aging in this build
+	if(!OP_FEATURE_AGING){
+		return 0;
+	}
+
+	//long jobs waiting in the SJF class age too
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+
+	sjf_age(ext);
+
+	//no low queue in this build -> nothing else to age
+	if(!OP_FEATURE_LOW){
+		return 0;
+	}
 
-		walker->age++; //increment age for each process
+	//age the low queue of every group that has one with processes in it
 
-		/*if starving process is found -> promote it to high queue*/
-		if(walker->age >= MAX_AGE) {
-			
-			walker = walker->next; //set walker for next iteration (so we don't lose )
-			append_queue(schedule->ready_queue_high, remove_process(schedule->ready_queue_low, position)); //delete current process and promote it to high queue
-		}
-		
-		//if starving process not found, increment position and iterate traditionally
-		else{
-			walker = walker->next;
-			position++;
+	for(int group = 0; group < ext->group_count; group++){
+
+		if(op_get_count(ext->groups[group].low) > 0){
+			spill_tick(ext->groups[group].low);
+			promote_queue(schedule, &ext->groups[group]);
 		}
 	}
+
+	//promotions bypass the high queues' limits but may have freed room in the low queues
+	for(int group = 0; group < ext->group_count; group++){
+		check_capacity(schedule, ext->groups[group].low);
+	}
 	
-	return -1;
+	return 0;
 }
 
 /*
@@ -592,12 +2503,18 @@ int op_exited(Op_schedule_s *schedule, Op_process_s *process, int exit_code){
                 return -1;
         }
 
+	//count the exit against the process' group
+	if(PROC_EXT(process)->group < (unsigned int)SCHED_EXT(schedule)->group_count){
+		STAT_INC(SCHED_EXT(schedule)->groups[PROC_EXT(process)->group].stats.exited);
+	}
+
 	set_state_on(process, DEFUNCT_FLAG); //set process to be defunct
 	unset_state(process, READY_FLAG); //set process not to be ready
 
         int gotta_be_safe = exit_code & STATE_FLAG; //create a mask from exit code with the 4 most significant bits OFF to be safe(keep rest the same)
         process->state |= gotta_be_safe; //set state bits for exit code
 
+        trace_op(schedule, OP_TRACE_EXITED, process, OP_TRACE_Q_DEFUNCT);
         return append_queue(schedule->defunct_queue, process); //add process to end of defunct queue
 }
 
@@ -629,10 +2546,45 @@ int op_terminated(Op_schedule_s *schedule, pid_t pid, int exit_code) {
 	//search and remove terminated process from high queue
 	if(high_queue_position >= 0){
 		terminated_process = remove_process(schedule->ready_queue_high, high_queue_position);
+		check_capacity(schedule, schedule->ready_queue_high);
 	}
 	//search and remove terminated process from low queue
 	else if(low_queue_position >= 0){
 		terminated_process = remove_process(schedule->ready_queue_low, low_queue_position);
+		check_capacity(schedule, schedule->ready_queue_low);
+	}
+	//not in the ungrouped queues -> search the low queue's spill store, the SJF heap, then the other groups' queues
+	else{
+
+		Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+
+		terminated_process = spill_take(schedule->ready_queue_low, pid);
+
+		if(terminated_process != NULL){
+			check_capacity(schedule, schedule->ready_queue_low);
+		}
+
+		for(int index = 0; index < ext->sjf_count && terminated_process == NULL; index++){
+			if(ext->sjf_heap[index]->pid == pid){
+				terminated_process = sjf_remove(ext, index);
+				break;
+			}
+		}
+
+		for(int group = 1; group < ext->group_count && terminated_process == NULL; group++){
+
+			high_queue_position = search_pid(ext->groups[group].high, pid);
+			low_queue_position = search_pid(ext->groups[group].low, pid);
+
+			if(high_queue_position >= 0){
+				terminated_process = remove_process(ext->groups[group].high, high_queue_position);
+				check_capacity(schedule, ext->groups[group].high);
+			}
+			else if(low_queue_position >= 0){
+				terminated_process = remove_process(ext->groups[group].low, low_queue_position);
+				check_capacity(schedule, ext->groups[group].low);
+			}
+		}
 	}
 
 	//if process found, update the state and add to defunct
@@ -641,11 +2593,486 @@ int op_terminated(Op_schedule_s *schedule, pid_t pid, int exit_code) {
 		set_state_on(terminated_process, DEFUNCT_FLAG); //set defunct flag on
 		unset_state(terminated_process, READY_FLAG); //set ready flag off
 		set_state_on(terminated_process, (exit_code & STATE_FLAG)); //set state to match 28 lsb of exit code
+		trace_op(schedule, OP_TRACE_TERMINATED, terminated_process, OP_TRACE_Q_DEFUNCT);
+		STAT_INC(SCHED_EXT(schedule)->groups[PROC_EXT(terminated_process)->group].stats.exited);
 	}
 	
 	return append_queue(schedule->defunct_queue, terminated_process);	
 }
 
+/*
+ * Creates a process group that gets shares dispatches per op_select_group round
+ * (ungrouped processes are group 0, which gets 1 share).
+ *
+ * Return the new group's id or -1 for error
+ */
+int op_group_create(Op_schedule_s *schedule, int shares){
+
+	if(schedule == NULL || shares <= 0 || SCHED_EXT(schedule)->group_count >= OP_MAX_GROUPS){
+		return -1;
+	}
+
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+	Op_group_s *group = &ext->groups[ext->group_count];
+
+	memset(group, 0, sizeof(Op_group_s));
+
+	group->high = queue_create(group->high);
+	if(group->high == NULL){
+		return -1;
+	}
+
+	group->low = queue_create(group->low);
+	if(group->low == NULL){
+		dealloc_queue(group->high);
+		return -1;
+	}
+
+	group->shares = shares;
+	group->prev = -1;
+	group->next = -1;
+
+	return ext->group_count++;
+}
+
+/*
+ * Returns a group's high or low ready queue (group 0's are ready_queue_high/low), for
+ * op_set_watermarks and op_get_count. The group keeps it, so callers must not add to, remove from
+ * or free it directly.
+ *
+ * Return the queue or NULL for error
+ */
+Op_queue_s *op_get_group_queue(Op_schedule_s *schedule, unsigned int group, int is_low){
+
+	if(schedule == NULL || group >= (unsigned int)SCHED_EXT(schedule)->group_count){
+		return NULL;
+	}
+
+	return is_low ? SCHED_EXT(schedule)->groups[group].low : SCHED_EXT(schedule)->groups[group].high;
+}
+
+/*
+ * Puts a process in a process group. Only call this while the process isn't in a queue.
+ * SJF class processes can't be grouped (op_set_class).
+ *
+ * Return 0 for success, -1 for error
+ */
+int op_set_group(Op_process_s *process, unsigned int group){
+
+	if(process == NULL || group >= OP_MAX_GROUPS || (group != 0 && PROC_EXT(process)->sched_class == OP_CLASS_SJF)){
+		return -1;
+	}
+
+	PROC_EXT(process)->group = group;
+	return 0;
+}
+
+/*
+ * Removes and returns the next process by group fair-share. Same as op_select, which goes
+ * through the groups deficit round robin style.
+ *
+ * Return NULL if nothing is ready.
+ */
+Op_process_s *op_select_group(Op_schedule_s *schedule){
+
+	return op_select(schedule);
+}
+
+/*
+ * Copies the counters of a process group.
+ *
+ * Return 0 for success, -1 for error
+ */
+int op_group_stats(Op_schedule_s *schedule, unsigned int group, Op_group_stats_s *stats){
+
+	if(schedule == NULL || stats == NULL || group >= (unsigned int)SCHED_EXT(schedule)->group_count){
+		return -1;
+	}
+
+	*stats = SCHED_EXT(schedule)->groups[group].stats;
+	return 0;
+}
+
+/*
+ * Puts a process in a gang (0 takes it out). Gang members are dispatched together
+ * by op_select_gang and promoted together by op_promote_processes.
+ *
+ * Return 0 for success, -1 for error
+ */
+int op_set_gang(Op_process_s *process, unsigned int gang){
+
+	if(process == NULL){
+		return -1;
+	}
+
+	PROC_EXT(process)->gang = gang;
+	return 0;
+}
+
+/*
+ * Removes the next process (the one op_select would hand out) and, if it belongs to a gang,
+ * up to max - 1 more ready members of that gang from its group's high then low queue,
+ * so they can run at the same time on max CPUs.
+ * -removed processes have their ages set to 0 and next pointers set to NULL
+ *
+ * Return the number of processes stored in selected (0 if nothing is ready), -1 for error
+ */
+int op_select_gang(Op_schedule_s *schedule, Op_process_s **selected, int max){
+
+	if(schedule == NULL || selected == NULL || max <= 0){
+		return -1;
+	}
+
+	Op_process_s *lead = op_select(schedule);
+
+	if(lead == NULL){
+		return 0;
+	}
+
+	selected[0] = lead;
+
+	unsigned int gang = PROC_EXT(lead)->gang;
+	if(gang == 0){
+		return 1;
+	}
+
+	//gather the rest of the gang
+	Op_group_s *group = &SCHED_EXT(schedule)->groups[PROC_EXT(lead)->group];
+	int count = 1;
+
+	count += take_gang(group->high, gang, selected + count, max - count);
+	check_capacity(schedule, group->high);
+
+	count += take_gang(group->low, gang, selected + count, max - count);
+	check_capacity(schedule, group->low);
+
+	for(int i = 1; i < count; i++){
+		trace_op(schedule, OP_TRACE_SELECT, selected[i], check_low(selected[i]) ? OP_TRACE_Q_LOW : OP_TRACE_Q_HIGH);
+	}
+
+	return count;
+}
+
+/*
+ * Turns on spilling for the schedule's low queue: once window processes are in its list,
+ * later ones are written to an append-only segment in a file mapping and left out of the
+ * list. They come back, oldest first, in batches once the list drains to half the window,
+ * and early if they reach MAX_AGE, so FIFO order and aging are the same as without
+ * spilling. op_terminated finds them too.
+ * -dir is the directory the file is made in (a new file with a unique name, unlinked right
+ *  away), /var/tmp for NULL. The records only leave RAM if that's on disk: in a tmpfs
+ *  (often /tmp) the page cache is RAM or swap, same as the heap
+ * -processes added with op_add keep their node while spilled, so only the list walks get
+ *  shorter. Processes added with op_add_owned have it freed and cost only their record
+ * -spilled gang members are promoted when they starve themselves, not with their gang
+ * -window of 0 pages everything back in and turns spilling off
+ * -calling it again while spilling only changes the window
+ *
+ * Return 0 for success, -1 for error
+ */
+int op_set_spill(Op_schedule_s *schedule, int window, const char *dir){
+
+	if(schedule == NULL || window < 0 || !OP_FEATURE_LOW){
+		return -1;
+	}
+
+	Op_queue_s *queue = schedule->ready_queue_low;
+	Op_spill_s *spill = QUEUE_EXT(queue)->spill;
+
+	//turning it off -> everything comes back first
+	if(window == 0){
+
+		if(spill != NULL){
+
+			if(spill_page_in(queue, spill->tail, 0) < 0){
+				return -1;
+			}
+
+			spill_destroy(spill);
+			QUEUE_EXT(queue)->spill = NULL;
+		}
+		return 0;
+	}
+
+	if(spill != NULL){
+		spill->window = window;
+		spill_refill(queue);
+		return 0;
+	}
+
+	spill = calloc(1, sizeof(Op_spill_s));
+	if(spill == NULL){
+		return -1;
+	}
+
+	//a new file nobody else has (mkstemp creates it exclusively), it only has to live as long as the mapping
+	char temp_path[PATH_MAX];
+
+	if(snprintf(temp_path, sizeof(temp_path), "%s/op_spill_XXXXXX", dir != NULL ? dir : SPILL_DIR) >= (int)sizeof(temp_path)){
+		free(spill);
+		return -1;
+	}
+
+	spill->fd = mkstemp(temp_path);
+
+	if(spill->fd < 0){
+		free(spill);
+		return -1;
+	}
+	unlink(temp_path);
+
+	spill->capacity = SPILL_START;
+
+	if(ftruncate(spill->fd, sizeof(Op_spill_rec_s) * spill->capacity) < 0 ||
+		(spill->recs = mmap(NULL, sizeof(Op_spill_rec_s) * spill->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, spill->fd, 0)) == MAP_FAILED){
+
+		close(spill->fd);
+		free(spill);
+		return -1;
+	}
+
+	spill->window = window;
+	QUEUE_EXT(queue)->spill = spill;
+	return 0;
+}
+
+/*
+ * Puts a process in a scheduling class (OP_CLASS_FIFO or OP_CLASS_SJF).
+ * Only call this while the process isn't in a queue.
+ * -SJF is for ungrouped processes only: it fails for a grouped process, and op_set_group
+ *  fails for an SJF one
+ * -SJF processes wait in a heap instead of the high/low queues (critical ones still go to the
+ *  high queue). op_select (and op_select_gang) hands them out as a third class of group 0,
+ *  sjf_weight of them per round next to the high and low ones (op_set_sjf_weight), and
+ *  op_select_sjf takes the head of the heap directly. op_select_high/op_select_low never see them
+ * -op_promote_processes ages them too: one that waited MAX_AGE promotions goes to the head of
+ *  the heap (it stays in the SJF class, it isn't moved to the high queue)
+ *
+ * Return 0 for success, -1 for error
+ */
+int op_set_class(Op_process_s *process, unsigned int sched_class){
+
+	if(process == NULL || sched_class > OP_CLASS_SJF || (sched_class == OP_CLASS_SJF && PROC_EXT(process)->group != 0)){
+		return -1;
+	}
+
+	PROC_EXT(process)->sched_class = sched_class;
+	return 0;
+}
+
+/*
+ * Removes and returns the SJF class process with the shortest predicted remaining
+ * burst (its command's averaged burst, minus what it already ran of the current one).
+ * Processes that waited MAX_AGE promotions come first, oldest first.
+ * -removed processes have their ages set to 0 and next pointers set to NULL
+ *
+ * Return NULL if the SJF class is empty.
+ */
+Op_process_s *op_select_sjf(Op_schedule_s *schedule){
+
+	if(schedule == NULL || SCHED_EXT(schedule)->sjf_count <= 0){
+		return NULL;
+	}
+
+	Op_process_s *selected = sjf_remove(SCHED_EXT(schedule), 0);
+
+	trace_op(schedule, OP_TRACE_SELECT, selected, OP_TRACE_Q_SJF);
+	return selected;
+}
+
+/*
+ * Turns on tracing of scheduling decisions into a ring of 2^capacity_log2 records,
+ * dropping anything traced so far. capacity_log2 of 0 turns tracing off.
+ *
+ * Return 0 for success, -1 for error
+ */
+int op_trace_enable(Op_schedule_s *schedule, unsigned int capacity_log2){
+
+	if(schedule == NULL || capacity_log2 > TRACE_MAX_LOG2 || (!OP_FEATURE_TRACE && capacity_log2 > 0)){
+		return -1;
+	}
+
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+
+	free(ext->trace_ring);
+	ext->trace_ring = NULL;
+	ext->trace_mask = 0;
+	ext->trace_head = 0;
+
+	if(capacity_log2 == 0){
+		return 0;
+	}
+
+	//zeroed so unused slots never look published
+	ext->trace_ring = calloc(1u << capacity_log2, sizeof(Op_trace_rec_s));
+	if(ext->trace_ring == NULL){
+		return -1;
+	}
+
+	ext->trace_mask = (1u << capacity_log2) - 1;
+	ext->trace_start_ticks = trace_ticks();
+	ext->trace_start_ns = trace_ns();
+	return 0;
+}
+
+/*
+ * Writes the traced decisions still in the ring to out, oldest first,
+ * after an Op_trace_header_s (see op_trace.h). Records still being written are skipped.
+ * Each record is copied out and only written if its seq didn't change meanwhile; records
+ * overwritten between counting and writing become OP_TRACE_LOST placeholders at the end
+ * so the file still holds header.count records.
+ *
+ * Return the number of records written or -1 for error
+ */
+long long op_trace_dump(Op_schedule_s *schedule, FILE *out){
+
+	if(schedule == NULL || out == NULL || SCHED_EXT(schedule)->trace_ring == NULL){
+		return -1;
+	}
+
+	Op_schedule_ext_s *ext = SCHED_EXT(schedule);
+	unsigned long long head = __atomic_load_n(&ext->trace_head, __ATOMIC_ACQUIRE);
+	unsigned long long size = (unsigned long long)ext->trace_mask + 1;
+	unsigned long long first = head > size ? head - size : 0;
+
+	//count complete records first so the header is right
+	unsigned long long count = 0;
+
+	for(unsigned long long slot = first; slot < head; slot++){
+		if(__atomic_load_n(&ext->trace_ring[slot & ext->trace_mask].seq, __ATOMIC_ACQUIRE) == (uint32_t)(slot + 1)){
+			count++;
+		}
+	}
+
+	Op_trace_header_s header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OP_TRACE_MAGIC, sizeof(header.magic));
+	header.version = OP_TRACE_VERSION;
+	header.rec_size = sizeof(Op_trace_rec_s);
+	header.count = count;
+	header.dropped = head - count;
+	header.start_ticks = ext->trace_start_ticks;
+	header.start_ns = ext->trace_start_ns;
+	header.end_ticks = trace_ticks();
+	header.end_ns = trace_ns();
+
+	if(fwrite(&header, sizeof(header), 1, out) != 1){
+		return -1;
+	}
+
+	//write the published records, oldest first
+	unsigned long long written = 0;
+
+	Op_trace_rec_s copy;
+
+	for(unsigned long long slot = first; slot < head && written < count; slot++){
+
+		Op_trace_rec_s *rec = &ext->trace_ring[slot & ext->trace_mask];
+		uint32_t seq = (uint32_t)(slot + 1);
+
+		if(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != seq){
+			continue;
+		}
+
+		//copy, then make sure no writer took the slot over while we did
+		copy = *rec;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if(__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) != seq){
+			continue;
+		}
+		copy.seq = seq;
+
+		if(fwrite(&copy, sizeof(Op_trace_rec_s), 1, out) != 1){
+			return -1;
+		}
+		written++;
+	}
+
+	//records lost to writers lapping the ring since they were counted
+	memset(&copy, 0, sizeof(copy));
+	copy.op = OP_TRACE_LOST;
+	copy.queue = OP_TRACE_Q_NONE;
+
+	for(; written < count; written++){
+		if(fwrite(&copy, sizeof(Op_trace_rec_s), 1, out) != 1){
+			return -1;
+		}
+	}
+
+	return written;
+}
+
+/*
+ * Writes every process in the defunct queue to out (oldest first) in batches and
+ * frees them, emptying the queue. Call it as often as needed while the scheduler
+ * runs: each call appends what has exited since the last one.
+ * -OP_EXPORT_COLUMNAR: binary columns with a command dictionary per batch (see op_export.h)
+ * -OP_EXPORT_CSV: "pid,exit_code,cmd" lines through a buffered writer
+ * -a batch is only removed from the queue once it was written, so after an error
+ *  the processes that didn't make it out are still in the queue
+ *
+ * Return the number of processes exported or -1 for error
+ */
+long long op_export_defunct(Op_schedule_s *schedule, FILE *out, int format){
+
+	if(schedule == NULL || out == NULL || (format != OP_EXPORT_COLUMNAR && format != OP_EXPORT_CSV)){
+		return -1;
+	}
+
+	Op_queue_s *queue = schedule->defunct_queue;
+	Op_export_buf_s *buf = malloc(sizeof(Op_export_buf_s));
+	unsigned int *marks = calloc(cmd_used + 1, sizeof(unsigned int));
+
+	if(buf == NULL || marks == NULL){
+		free(buf);
+		free(marks);
+		return -1;
+	}
+
+	buf->csv_used = 0;
+
+	long long exported = 0;
+	unsigned int batch = 0;
+	int status = 0;
+
+	while(queue->count > 0 && status == 0){
+
+		//next batch from the head of the queue (left in it until it's written)
+		int count = 0;
+
+		for(Op_process_s *walker = queue->head; walker != NULL && count < EXPORT_BATCH; walker = walker->next){
+			buf->procs[count++] = walker;
+		}
+
+		batch++;
+		status = format == OP_EXPORT_COLUMNAR ? export_columns(out, buf, count, marks, batch) : export_csv(out, buf, count);
+
+		//rest of the batch's csv lines
+		if(status == 0 && buf->csv_used > 0){
+			status = fwrite(buf->csv, 1, buf->csv_used, out) == buf->csv_used ? 0 : -1;
+			buf->csv_used = 0;
+		}
+
+		//written -> gone from the queue
+		if(status == 0){
+
+			for(int i = 0; i < count; i++){
+
+				Op_process_s *dead_process = remove_from_front(queue);
+
+				release_cmd(PROC_EXT(dead_process)->cmd_id);
+				free(dead_process);
+			}
+			exported += count;
+		}
+	}
+
+	free(buf);
+	free(marks);
+	return status < 0 ? -1 : exported;
+}
+
 /*
  * Free all dynamically allocate memory used by this program
  */
@@ -657,6 +3084,21 @@ void op_deallocate(Op_schedule_s *schedule){
 	dealloc_queue(schedule->ready_queue_high);
 	dealloc_queue(schedule->defunct_queue);
 
+	//group 0's queues are the ones freed above
+	for(int group = 1; group < SCHED_EXT(schedule)->group_count; group++){
+		dealloc_queue(SCHED_EXT(schedule)->groups[group].high);
+		dealloc_queue(SCHED_EXT(schedule)->groups[group].low);
+	}
+
+	//processes still waiting in the SJF class
+	for(int index = 0; index < SCHED_EXT(schedule)->sjf_count; index++){
+		release_cmd(PROC_EXT(SCHED_EXT(schedule)->sjf_heap[index])->cmd_id);
+		free(SCHED_EXT(schedule)->sjf_heap[index]);
+	}
+	free(SCHED_EXT(schedule)->sjf_heap);
+
+	free(SCHED_EXT(schedule)->trace_ring);
+	free(SCHED_EXT(schedule)->gang_marks);
 	free(schedule);		
 	schedule = NULL; //eliminate dangling pointer
 }
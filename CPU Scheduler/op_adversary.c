@@ -0,0 +1,792 @@
+/* Adversarial workload search for scheduler tail latency.
+ *
+ * Usage: op_adversary [-n max_processes] [-i iterations] [-r reps] [-s seed]
+ *                     [-o workloads_out] [-l workloads_in] [-b baseline] [-B baseline_out] [-t tolerance%]
+ *                     [-q count]
+ *
+ * - a workload describes the queues a schedule is in right before an operation:
+ *   queue depths, where the critical processes sit, how many low processes are one
+ *   promotion away from MAX_AGE, gang sizes, the SJF heap, extra groups and which
+ *   pid op_terminated is asked for
+ * - for each of op_select_high, op_promote_processes and op_terminated a guided random
+ *   search (mutate the worst workload found so far, keep the mutant if its mean latency
+ *   is higher) looks for the workload that makes that operation slowest
+ * - every timed call is a sample: the worst case is reported per operation, over every call
+ * - p99.99 comes from ADV_TAIL_SAMPLES more calls on the worst workload found, enough that
+ *   ADV_TAIL_SAMPLES / 10000 of them lie above it (with fewer it would just be the maximum)
+ * - -o writes the worst workload of each operation, -l replays workloads instead of searching
+ *
+ * Catching regressions (replays use the same -r so the workloads are the same):
+ *   op_adversary -o adversary.txt                  search once, keep adversary.txt
+ *   op_adversary -l adversary.txt -B baseline.txt  record the baseline on the known good build
+ *   op_adversary -l adversary.txt -b baseline.txt  after a change: exit 1 if any p99.99
+ *                                                  is more than tolerance% over the baseline
+ * The worst case is a single sample (one interrupt away from anything), so it's reported
+ * but only p99.99 is compared.
+ *
+ * -q count checks that op_promote_processes stays linear in the layout that once made it
+ * quadratic (count low processes all starving, each in a gang of its own): it times the
+ * promotion of that queue against the same processes without gangs (only the first call
+ * on a fresh queue, later ones have nothing left to promote) and exits 1 if the gangs make
+ * it more than ADV_GANG_LIMIT times slower. Both runs see the same queue, so no baseline is
+ * needed:
+ *   op_adversary -q 20000
+ *
+ * Build next to the scheduler with every feature on:
+ *   cc -O2 op_adversary.c "Scheduling Project.c" -o op_adversary
+ * (or make op_adversary, which builds against the stand-in starter headers in stub/)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "op_sched.h"
+#include "op_sched_ext.h"
+
+//operations under attack
+#define ADV_SELECT_HIGH 0
+#define ADV_PROMOTE     1
+#define ADV_TERMINATED  2
+#define ADV_OPS         3
+
+//-q: slowdown gangs may cause, and runs of each layout (the best one counts)
+#define ADV_GANG_LIMIT 4
+#define ADV_GANG_RUNS  5
+
+//timed calls on each operation's worst workload that its p99.99 is taken from
+//(10 of them lie above p99.99)
+#define ADV_TAIL_SAMPLES 100000
+
+//where the pid given to op_terminated lives
+#define ADV_VICTIM_HIGH    0
+#define ADV_VICTIM_LOW     1
+#define ADV_VICTIM_SJF     2
+#define ADV_VICTIM_GROUPED 3
+#define ADV_VICTIM_MISSING 4
+
+/*
+ * Layout of a schedule right before the timed operation.
+ * Positions are fractions of the queue they refer to.
+ */
+typedef struct adv_workload {
+	unsigned int high;       //ungrouped high processes
+	unsigned int low;        //ungrouped low processes
+	unsigned int sjf;        //processes in the SJF heap
+	unsigned int grouped;    //low processes in the last extra group
+	unsigned int groups;     //extra groups (grouped processes need at least 1)
+	unsigned int crit_count; //critical processes in the high queue, next to each other
+	double crit_pos;         //where in the high queue they start
+	double storm;            //fraction of low processes one promotion away from MAX_AGE
+	unsigned int gang_size;  //low processes per gang (0 = no gangs)
+	unsigned int victim;     //ADV_VICTIM_*
+	double victim_pos;       //where in its queue the first victim sits
+} adv_workload;
+
+/*
+ * Latency samples of one operation.
+ */
+typedef struct adv_samples {
+	unsigned long long *ns;
+	unsigned long count;
+	unsigned long capacity;
+} adv_samples;
+
+const char *op_names[ADV_OPS] = {"op_select_high", "op_promote_processes", "op_terminated"};
+
+//settings
+static unsigned int max_processes = 20000;
+static unsigned int iterations = 300;
+static unsigned int reps = 32;
+
+//helper prototypes
+unsigned long long now_ns();
+double rand_unit();
+unsigned int mutate_count(unsigned int count);
+double mutate_pos(double pos);
+void clamp_workload(adv_workload *work);
+adv_workload random_workload();
+adv_workload mutate_workload(const adv_workload *work);
+Op_schedule_s *build_schedule(const adv_workload *work, pid_t *first_pid);
+pid_t victim_pid(const adv_workload *work, const pid_t *first_pid, unsigned int rep);
+double run_workload(int op, const adv_workload *work, adv_samples *samples, unsigned int calls);
+double promote_storm(unsigned int count, unsigned int gang_size, adv_samples *samples);
+int add_sample(adv_samples *samples, unsigned long long ns);
+int compare_ns(const void *a, const void *b);
+unsigned long long percentile(adv_samples *samples, double fraction);
+int write_workload(FILE *out, int op, const adv_workload *work);
+int read_workload(FILE *in, int *op, adv_workload *work);
+
+/*
+ * HELPER
+ * Monotonic clock in ns.
+ */
+unsigned long long now_ns(){
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * HELPER
+ * Uniform random number in [0, 1).
+ */
+double rand_unit(){
+
+	return (double)random() / ((double)RAND_MAX + 1.0);
+}
+
+/*
+ * HELPER
+ * Scales a count by a random factor between 1/2 and 2, or nudges it by a few.
+ */
+unsigned int mutate_count(unsigned int count){
+
+	if(random() % 2){
+		return (unsigned int)(count * (0.5 + 1.5 * rand_unit()));
+	}
+
+	int nudged = (int)count + (int)(random() % 9) - 4;
+
+	return nudged < 0 ? 0 : (unsigned int)nudged;
+}
+
+/*
+ * HELPER
+ * Moves a position by up to 0.25 either way, or jumps to one of the ends.
+ */
+double mutate_pos(double pos){
+
+	if(random() % 4 == 0){
+		return random() % 2 ? 1.0 : 0.0;
+	}
+
+	pos += (rand_unit() - 0.5) * 0.5;
+
+	return pos < 0 ? 0 : pos > 1 ? 1 : pos;
+}
+
+/*
+ * HELPER
+ * Keeps a workload within max_processes and its fields consistent.
+ */
+void clamp_workload(adv_workload *work){
+
+	unsigned long long total = (unsigned long long)work->high + work->low + work->sjf + work->grouped;
+
+	//too many processes -> shrink every queue by the same factor
+	if(total > max_processes){
+
+		double scale = (double)max_processes / (double)total;
+
+		work->high = (unsigned int)(work->high * scale);
+		work->low = (unsigned int)(work->low * scale);
+		work->sjf = (unsigned int)(work->sjf * scale);
+		work->grouped = (unsigned int)(work->grouped * scale);
+	}
+
+	if(work->groups >= OP_MAX_GROUPS){
+		work->groups = OP_MAX_GROUPS - 1;
+	}
+
+	if(work->grouped > 0 && work->groups == 0){
+		work->groups = 1;
+	}
+
+	if(work->crit_count > work->high){
+		work->crit_count = work->high;
+	}
+
+	if(work->victim > ADV_VICTIM_MISSING){
+		work->victim = ADV_VICTIM_MISSING;
+	}
+}
+
+/*
+ * HELPER
+ * Starting point of a search: a bit of everything.
+ */
+adv_workload random_workload(){
+
+	adv_workload work;
+
+	work.high = random() % (max_processes / 4 + 1);
+	work.low = random() % (max_processes / 4 + 1);
+	work.sjf = random() % (max_processes / 16 + 1);
+	work.grouped = random() % (max_processes / 16 + 1);
+	work.groups = 1 + random() % 4;
+	work.crit_count = random() % 4;
+	work.crit_pos = rand_unit();
+	work.storm = rand_unit();
+	work.gang_size = random() % 4;
+	work.victim = random() % (ADV_VICTIM_MISSING + 1);
+	work.victim_pos = rand_unit();
+
+	clamp_workload(&work);
+	return work;
+}
+
+/*
+ * HELPER
+ * Copy of a workload with a few of its fields changed (at least one).
+ */
+adv_workload mutate_workload(const adv_workload *work){
+
+	adv_workload mutant = *work;
+	int changed = 0;
+
+	while(!changed){
+
+		if(random() % 3 == 0){ mutant.high = mutate_count(mutant.high); changed = 1; }
+		if(random() % 3 == 0){ mutant.low = mutate_count(mutant.low); changed = 1; }
+		if(random() % 4 == 0){ mutant.sjf = mutate_count(mutant.sjf); changed = 1; }
+		if(random() % 4 == 0){ mutant.grouped = mutate_count(mutant.grouped); changed = 1; }
+		if(random() % 4 == 0){ mutant.groups = mutate_count(mutant.groups); changed = 1; }
+		if(random() % 3 == 0){ mutant.crit_count = mutate_count(mutant.crit_count); changed = 1; }
+		if(random() % 3 == 0){ mutant.crit_pos = mutate_pos(mutant.crit_pos); changed = 1; }
+		if(random() % 3 == 0){ mutant.storm = mutate_pos(mutant.storm); changed = 1; }
+		if(random() % 4 == 0){ mutant.gang_size = mutate_count(mutant.gang_size); changed = 1; }
+		if(random() % 5 == 0){ mutant.victim = random() % (ADV_VICTIM_MISSING + 1); changed = 1; }
+		if(random() % 3 == 0){ mutant.victim_pos = mutate_pos(mutant.victim_pos); changed = 1; }
+	}
+
+	clamp_workload(&mutant);
+	return mutant;
+}
+
+/*
+ * HELPER
+ * Builds a schedule laid out as described by work. Pids are handed out queue by queue,
+ * first_pid[ADV_VICTIM_*] gets the first pid of each queue.
+ *
+ * Return NULL for error.
+ */
+Op_schedule_s *build_schedule(const adv_workload *work, pid_t *first_pid){
+
+	Op_schedule_s *schedule = op_create();
+	pid_t pid = 1;
+
+	if(schedule == NULL){
+		return NULL;
+	}
+
+	//the grouped processes go in the last group created
+	unsigned int last_group = 0;
+
+	for(unsigned int i = 0; i < work->groups; i++){
+
+		int id = op_group_create(schedule, 1);
+
+		if(id < 0){
+			op_deallocate(schedule);
+			return NULL;
+		}
+		last_group = id;
+	}
+
+	//high queue, the critical run starts crit_pos of the way in
+	unsigned int crit_start = (unsigned int)(work->crit_pos * (work->high - work->crit_count));
+
+	first_pid[ADV_VICTIM_HIGH] = pid;
+
+	for(unsigned int i = 0; i < work->high; i++){
+
+		int critical = i >= crit_start && i < crit_start + work->crit_count;
+		Op_process_s *process = op_new_process("high", pid++, 0, critical);
+
+		if(process == NULL || op_add(schedule, process) != 0){
+			op_free_process(process);
+			op_deallocate(schedule);
+			return NULL;
+		}
+	}
+
+	//low queues: storm of them one promotion away from MAX_AGE, the rest spread over younger ages
+	for(int queue = ADV_VICTIM_LOW; queue <= ADV_VICTIM_GROUPED; queue++){
+
+		unsigned int count = queue == ADV_VICTIM_LOW ? work->low : queue == ADV_VICTIM_SJF ? work->sjf : work->grouped;
+
+		first_pid[queue] = pid;
+
+		for(unsigned int i = 0; i < count; i++){
+
+			Op_process_s *process = op_new_process(queue == ADV_VICTIM_SJF ? "sjf" : "low", pid++, queue != ADV_VICTIM_SJF, 0);
+
+			if(process == NULL){
+				op_deallocate(schedule);
+				return NULL;
+			}
+
+			if(queue == ADV_VICTIM_SJF){
+				op_set_class(process, OP_CLASS_SJF);
+			}
+			else{
+				if(queue == ADV_VICTIM_GROUPED){
+					op_set_group(process, last_group);
+				}
+				if(work->gang_size > 0){
+					op_set_gang(process, 1 + i / work->gang_size);
+				}
+			}
+
+			process->age = rand_unit() < work->storm ? MAX_AGE - 1 : (int)(random() % (MAX_AGE - 1));
+
+			if(op_add(schedule, process) != 0){
+				op_free_process(process);
+				op_deallocate(schedule);
+				return NULL;
+			}
+		}
+	}
+
+	first_pid[ADV_VICTIM_MISSING] = pid;
+	return schedule;
+}
+
+/*
+ * HELPER
+ * Pid op_terminated is asked for on the given rep: victim_pos of the way into the
+ * victim's queue, then the ones after it (processes from earlier reps are gone).
+ */
+pid_t victim_pid(const adv_workload *work, const pid_t *first_pid, unsigned int rep){
+
+	unsigned int count = work->victim == ADV_VICTIM_HIGH ? work->high :
+		work->victim == ADV_VICTIM_LOW ? work->low :
+		work->victim == ADV_VICTIM_SJF ? work->sjf :
+		work->victim == ADV_VICTIM_GROUPED ? work->grouped : 0;
+
+	//empty queue or a pid nobody has -> every queue gets searched
+	if(count == 0){
+		return first_pid[ADV_VICTIM_MISSING] + rep;
+	}
+
+	return first_pid[work->victim] + ((unsigned int)(work->victim_pos * (count - 1)) + rep) % count;
+}
+
+/*
+ * HELPER
+ * Builds the workload and times calls calls of op on it. Processes handed out by
+ * op_select_high are added back (untimed), so later calls see them at the tail.
+ *
+ * Return the mean latency in ns, -1 for error
+ */
+double run_workload(int op, const adv_workload *work, adv_samples *samples, unsigned int calls){
+
+	pid_t first_pid[ADV_VICTIM_MISSING + 1];
+	Op_schedule_s *schedule = build_schedule(work, first_pid);
+
+	if(schedule == NULL){
+		return -1;
+	}
+
+	unsigned long long total = 0;
+
+	for(unsigned int rep = 0; rep < calls; rep++){
+
+		Op_process_s *selected = NULL;
+		pid_t victim = op == ADV_TERMINATED ? victim_pid(work, first_pid, rep) : 0;
+		unsigned long long start = now_ns();
+
+		if(op == ADV_SELECT_HIGH){
+			selected = op_select_high(schedule);
+		}
+		else if(op == ADV_PROMOTE){
+			op_promote_processes(schedule);
+		}
+		else{
+			op_terminated(schedule, victim, 0);
+		}
+
+		unsigned long long elapsed = now_ns() - start;
+
+		if(selected != NULL){
+			op_add(schedule, selected);
+		}
+
+		total += elapsed;
+		if(add_sample(samples, elapsed) < 0){
+			op_deallocate(schedule);
+			return -1;
+		}
+	}
+
+	op_deallocate(schedule);
+	return (double)total / calls;
+}
+
+/*
+ * HELPER
+ * Times op_promote_processes on count low processes that are all about to starve, in gangs
+ * of gang_size (0 = no gangs), best of ADV_GANG_RUNS runs so a stray interrupt doesn't count.
+ * Each run times one call on a freshly built queue: that call promotes all of them, any
+ * later one would find nothing to promote.
+ *
+ * Return the latency in ns, -1 for error
+ */
+double promote_storm(unsigned int count, unsigned int gang_size, adv_samples *samples){
+
+	adv_workload work;
+	double best = -1;
+
+	memset(&work, 0, sizeof(work));
+	work.low = count;
+	work.storm = 1.0;
+	work.gang_size = gang_size;
+	work.victim = ADV_VICTIM_MISSING;
+
+	for(int run = 0; run < ADV_GANG_RUNS; run++){
+
+		double mean = run_workload(ADV_PROMOTE, &work, samples, 1);
+
+		if(mean < 0){
+			return -1;
+		}
+		if(best < 0 || mean < best){
+			best = mean;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * HELPER
+ * Appends a latency sample, growing the array if needed.
+ * Return 0 for success, -1 for error
+ */
+int add_sample(adv_samples *samples, unsigned long long ns){
+
+	if(samples->count == samples->capacity){
+
+		unsigned long new_capacity = samples->capacity == 0 ? 4096 : samples->capacity * 2;
+		unsigned long long *new_ns = realloc(samples->ns, sizeof(unsigned long long) * new_capacity);
+
+		if(new_ns == NULL){
+			return -1;
+		}
+		samples->ns = new_ns;
+		samples->capacity = new_capacity;
+	}
+
+	samples->ns[samples->count++] = ns;
+	return 0;
+}
+
+/*
+ * HELPER
+ * qsort comparator for latencies.
+ */
+int compare_ns(const void *a, const void *b){
+
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * HELPER
+ * Nearest rank percentile of the samples (sorts them). 0 when there are none.
+ */
+unsigned long long percentile(adv_samples *samples, double fraction){
+
+	if(samples->count == 0){
+		return 0;
+	}
+
+	qsort(samples->ns, samples->count, sizeof(unsigned long long), compare_ns);
+
+	unsigned long rank = (unsigned long)(fraction * samples->count + 0.999999);
+
+	return samples->ns[rank == 0 ? 0 : rank - 1];
+}
+
+/*
+ * HELPER
+ * Writes one workload as a line of text.
+ * Return 0 for success, -1 for error
+ */
+int write_workload(FILE *out, int op, const adv_workload *work){
+
+	int written = fprintf(out, "%s high=%u low=%u sjf=%u grouped=%u groups=%u crit=%u crit_pos=%.4f storm=%.4f gang=%u victim=%u victim_pos=%.4f\n",
+		op_names[op], work->high, work->low, work->sjf, work->grouped, work->groups, work->crit_count,
+		work->crit_pos, work->storm, work->gang_size, work->victim, work->victim_pos);
+
+	return written < 0 ? -1 : 0;
+}
+
+/*
+ * HELPER
+ * Reads a workload line written by write_workload.
+ * Return 1 for a workload, 0 at the end of the file, -1 for a malformed line
+ */
+int read_workload(FILE *in, int *op, adv_workload *work){
+
+	char name[64];
+	int fields = fscanf(in, "%63s high=%u low=%u sjf=%u grouped=%u groups=%u crit=%u crit_pos=%lf storm=%lf gang=%u victim=%u victim_pos=%lf",
+		name, &work->high, &work->low, &work->sjf, &work->grouped, &work->groups, &work->crit_count,
+		&work->crit_pos, &work->storm, &work->gang_size, &work->victim, &work->victim_pos);
+
+	if(fields == EOF){
+		return 0;
+	}
+
+	if(fields != 12){
+		return -1;
+	}
+
+	for(*op = 0; *op < ADV_OPS; (*op)++){
+		if(strcmp(name, op_names[*op]) == 0){
+			clamp_workload(work);
+			return 1;
+		}
+	}
+
+	return -1;
+}
+
+int main(int argc, char *argv[]){
+
+	int opt;
+	unsigned int seed = 1;
+	unsigned int tolerance = 25;
+	char *workloads_out = NULL;
+	char *workloads_in = NULL;
+	char *baseline_in = NULL;
+	char *baseline_out = NULL;
+	unsigned int scale_count = 0;
+
+	while((opt = getopt(argc, argv, "n:i:r:s:o:l:b:B:t:q:")) != -1){
+
+		switch(opt){
+			case 'n': max_processes = strtoul(optarg, NULL, 10); break;
+			case 'i': iterations = strtoul(optarg, NULL, 10); break;
+			case 'r': reps = strtoul(optarg, NULL, 10); break;
+			case 's': seed = strtoul(optarg, NULL, 10); break;
+			case 'o': workloads_out = optarg; break;
+			case 'l': workloads_in = optarg; break;
+			case 'b': baseline_in = optarg; break;
+			case 'B': baseline_out = optarg; break;
+			case 't': tolerance = strtoul(optarg, NULL, 10); break;
+			case 'q': scale_count = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n max_processes] [-i iterations] [-r reps] [-s seed]\n"
+					"       [-o workloads_out] [-l workloads_in] [-b baseline] [-B baseline_out] [-t tolerance%%]\n"
+					"       [-q count]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(max_processes == 0 || iterations == 0 || reps == 0){
+		fprintf(stderr, "%s: processes, iterations and reps must be positive\n", argv[0]);
+		return 1;
+	}
+
+	srandom(seed);
+
+	//gang promotion check instead of a search
+	if(scale_count > 0){
+
+		adv_samples storm_samples;
+		memset(&storm_samples, 0, sizeof(storm_samples));
+
+		double plain = promote_storm(scale_count, 0, &storm_samples);
+		double gangs = promote_storm(scale_count, 1, &storm_samples);
+
+		free(storm_samples.ns);
+
+		if(plain < 0 || gangs < 0){
+			fprintf(stderr, "%s: could not build workload\n", argv[0]);
+			return 1;
+		}
+
+		double slowdown = gangs / (plain > 0 ? plain : 1);
+
+		printf("op_promote_processes, %u starving: %.0f ns without gangs, %.0f ns one gang each (%.1fx)\n",
+			scale_count, plain, gangs, slowdown);
+
+		if(slowdown > ADV_GANG_LIMIT){
+			printf("REGRESSION op_promote_processes: gangs make it %.1fx slower (%ux allowed)\n",
+				slowdown, ADV_GANG_LIMIT);
+			return 1;
+		}
+
+		return 0;
+	}
+
+	adv_samples samples[ADV_OPS];
+	adv_workload worst[ADV_OPS];
+	double worst_mean[ADV_OPS];
+	int have[ADV_OPS];
+
+	memset(samples, 0, sizeof(samples));
+
+	for(int op = 0; op < ADV_OPS; op++){
+		have[op] = 0;
+		worst_mean[op] = -1;
+	}
+
+	//replay: every saved workload is measured iterations times
+	if(workloads_in != NULL){
+
+		FILE *in = fopen(workloads_in, "r");
+		int op;
+		adv_workload work;
+		int status;
+
+		if(in == NULL){
+			perror(workloads_in);
+			return 1;
+		}
+
+		while((status = read_workload(in, &op, &work)) == 1){
+
+			for(unsigned int i = 0; i < iterations; i++){
+
+				double mean = run_workload(op, &work, &samples[op], reps);
+
+				if(mean < 0){
+					fprintf(stderr, "%s: could not build workload\n", argv[0]);
+					return 1;
+				}
+				if(mean > worst_mean[op]){
+					worst_mean[op] = mean;
+				}
+			}
+
+			worst[op] = work;
+			have[op] = 1;
+		}
+
+		fclose(in);
+
+		if(status < 0){
+			fprintf(stderr, "%s: malformed workload\n", workloads_in);
+			return 1;
+		}
+	}
+
+	//search: each operation climbs from a random workload toward its slowest one
+	else{
+
+		for(unsigned int i = 0; i < iterations; i++){
+
+			int op = i % ADV_OPS;
+			adv_workload work = have[op] ? mutate_workload(&worst[op]) : random_workload();
+			double mean = run_workload(op, &work, &samples[op], reps);
+
+			if(mean < 0){
+				fprintf(stderr, "%s: could not build workload\n", argv[0]);
+				return 1;
+			}
+
+			if(mean > worst_mean[op]){
+				worst_mean[op] = mean;
+				worst[op] = work;
+				have[op] = 1;
+			}
+		}
+	}
+
+	//report (and write out) the results
+	FILE *workloads = workloads_out != NULL ? fopen(workloads_out, "w") : NULL;
+	FILE *baseline = baseline_out != NULL ? fopen(baseline_out, "w") : NULL;
+
+	if((workloads_out != NULL && workloads == NULL) || (baseline_out != NULL && baseline == NULL)){
+		perror(workloads == NULL && workloads_out != NULL ? workloads_out : baseline_out);
+		return 1;
+	}
+
+	unsigned long long p9999[ADV_OPS];
+
+	printf("%-22s %10s %12s %12s %14s\n", "operation", "samples", "worst_ns", "p99.99_ns", "worst_mean_ns");
+
+	for(int op = 0; op < ADV_OPS; op++){
+
+		if(!have[op]){
+			continue;
+		}
+
+		//the tail of the worst workload, from enough calls to have one
+		adv_samples tail;
+		memset(&tail, 0, sizeof(tail));
+
+		while(tail.count < ADV_TAIL_SAMPLES){
+			if(run_workload(op, &worst[op], &tail, reps) < 0){
+				fprintf(stderr, "%s: could not build workload\n", argv[0]);
+				return 1;
+			}
+		}
+
+		p9999[op] = percentile(&tail, 0.9999);
+
+		//worst case over the search and the tail calls
+		unsigned long long worst_ns = percentile(&samples[op], 1.0);
+
+		if(tail.ns[tail.count - 1] > worst_ns){
+			worst_ns = tail.ns[tail.count - 1];
+		}
+
+		printf("%-22s %10lu %12llu %12llu %14.0f\n", op_names[op], samples[op].count + tail.count,
+			worst_ns, p9999[op], worst_mean[op]);
+		free(tail.ns);
+		printf("  worst workload: ");
+		write_workload(stdout, op, &worst[op]);
+
+		if(workloads != NULL){
+			write_workload(workloads, op, &worst[op]);
+		}
+		if(baseline != NULL){
+			fprintf(baseline, "%s %llu\n", op_names[op], p9999[op]);
+		}
+	}
+
+	if(workloads != NULL){
+		fclose(workloads);
+	}
+	if(baseline != NULL){
+		fclose(baseline);
+	}
+
+	//regression check against a recorded baseline
+	int regressed = 0;
+
+	if(baseline_in != NULL){
+
+		FILE *in = fopen(baseline_in, "r");
+		char name[64];
+		unsigned long long limit;
+
+		if(in == NULL){
+			perror(baseline_in);
+			return 1;
+		}
+
+		while(fscanf(in, "%63s %llu", name, &limit) == 2){
+
+			for(int op = 0; op < ADV_OPS; op++){
+
+				if(!have[op] || strcmp(name, op_names[op]) != 0){
+					continue;
+				}
+
+				if(p9999[op] * 100 > limit * (100 + tolerance)){
+					printf("REGRESSION %s: p99.99 %llu ns, baseline %llu ns (+%u%% allowed)\n",
+						op_names[op], p9999[op], limit, tolerance);
+					regressed = 1;
+				}
+			}
+		}
+
+		fclose(in);
+	}
+
+	for(int op = 0; op < ADV_OPS; op++){
+		free(samples[op].ns);
+	}
+
+	return regressed;
+}
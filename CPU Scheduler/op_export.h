@@ -0,0 +1,47 @@
+/* Export of the defunct queue for exit code analytics (see op_export_defunct).
+ *
+ * OP_EXPORT_COLUMNAR writes a sequence of batches, each one:
+ *   Op_export_batch_s
+ *   int32_t  pid[count]
+ *   uint32_t exit_code[count]   //low 28 bits of the process state
+ *   uint32_t cmd_id[count]      //command intern id
+ *   dict_count x (Op_export_dict_s followed by len bytes of the command, no terminator)
+ * A batch's dictionary holds every command its cmd_id column uses, so batches stand on
+ * their own (an id can be reused for another command once nothing uses it anymore).
+ *
+ * OP_EXPORT_CSV writes one "pid,exit_code,cmd" line per process, no header line
+ * (cmd is quoted, with quotes doubled, when it holds a comma, quote or newline).
+ */
+
+#ifndef OP_EXPORT_H
+#define OP_EXPORT_H
+
+#include <stdint.h>
+
+#define OP_EXPORT_COLUMNAR 0
+#define OP_EXPORT_CSV      1
+
+//first 8 bytes of every columnar batch
+#define OP_EXPORT_MAGIC "OPEXPRT1"
+#define OP_EXPORT_VERSION 1
+
+/*
+ * Columnar batch header (24 bytes).
+ */
+typedef struct op_export_batch_struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;      //processes in the batch
+	uint32_t dict_count; //dictionary entries after the columns
+	uint32_t pad;
+} Op_export_batch_s;
+
+/*
+ * Dictionary entry header, followed by len bytes of the command.
+ */
+typedef struct op_export_dict_struct {
+	uint32_t cmd_id;
+	uint32_t len;
+} Op_export_dict_s;
+
+#endif
@@ -0,0 +1,276 @@
+/* Extensions to the scheduler that live on top of op_sched.h.
+ * - op_sched.h belongs to the starter code and its structs can't change,
+ *   so every extra field lives in a wrapper struct that embeds the original
+ *   struct as its FIRST member.
+ * - op_new_process(), op_create() and the queue constructor allocate the
+ *   wrappers, so any Op_process_s, Op_schedule_s or Op_queue_s handed out
+ *   by them can be cast back.
+ */
+
+#ifndef OP_SCHED_EXT_H
+#define OP_SCHED_EXT_H
+
+#include <stdio.h>
+#include "op_sched.h"
+#include "op_trace.h"
+#include "op_export.h"
+
+/* Build configuration.
+ * Every feature defaults to ON. Turning one off with -D makes its checks
+ * compile-time constants, so the branches drop out of every op_* function.
+ *   OP_FEATURE_CRITICAL  critical lane (critical-first selection, admission reserve)
+ *   OP_FEATURE_LOW       low queue (op_new_process rejects is_low when off)
+ *   OP_FEATURE_AGING     op_promote_processes (a no-op when off)
+ *   OP_FEATURE_STATS     per-command and per-group counters
+ *   OP_FEATURE_TRACE     trace ring logging (op_trace_enable fails when off)
+ *   OP_QUEUE_ENGINE      OP_ENGINE_TAIL: queues cache their tail and count their critical
+ *                        processes, appends are O(1) and critical searches stop early
+ *                        OP_ENGINE_WALK: the original representation, a plain list with
+ *                        neither (appends and critical searches walk it, the tail and
+ *                        crit_count fields of Op_queue_ext_s go unused)
+ * The queues themselves stay linked lists because op_sched.h exposes them that way: callers
+ * walk head/next, so there is no struct-of-arrays or heap engine for the FIFO queues. The
+ * heap ordered queue is the SJF class (op_set_class), picked per schedule at run time.
+ *
+ * Variants used for side by side benchmarks (same sources, one binary each), built by the
+ * Makefile as op_sim-<variant> and run one after another by make bench:
+ *   full:    cc ... "Scheduling Project.c"
+ *   nocrit:  cc ... -DOP_FEATURE_CRITICAL=0 "Scheduling Project.c"
+ *   fifo:    cc ... -DOP_FEATURE_CRITICAL=0 -DOP_FEATURE_LOW=0 -DOP_FEATURE_AGING=0 \
+ *                   -DOP_FEATURE_STATS=0 -DOP_FEATURE_TRACE=0 "Scheduling Project.c"
+ *   walk:    cc ... -DOP_QUEUE_ENGINE=OP_ENGINE_WALK "Scheduling Project.c"
+ */
+#define OP_ENGINE_WALK 0
+#define OP_ENGINE_TAIL 1
+
+#ifndef OP_FEATURE_CRITICAL
+#define OP_FEATURE_CRITICAL 1
+#endif
+#ifndef OP_FEATURE_LOW
+#define OP_FEATURE_LOW 1
+#endif
+#ifndef OP_FEATURE_AGING
+#define OP_FEATURE_AGING 1
+#endif
+#ifndef OP_FEATURE_STATS
+#define OP_FEATURE_STATS 1
+#endif
+#ifndef OP_FEATURE_TRACE
+#define OP_FEATURE_TRACE 1
+#endif
+#ifndef OP_QUEUE_ENGINE
+#define OP_QUEUE_ENGINE OP_ENGINE_TAIL
+#endif
+
+//time slice handed out to a fresh (or low queue) process and the floor the adaptive policy shrinks high queue hogs to
+#define BASE_QUANTUM_NS  10000000ULL   // 10ms
+#define MIN_QUANTUM_NS    1000000ULL   //  1ms
+
+//promotions a low process waits before it is starving (and moves to its high queue)
+#define MAX_AGE 5
+
+//most process groups a schedule can have (group 0 is the schedule's own ready queues)
+#define OP_MAX_GROUPS 64
+
+//scheduling classes (op_set_class)
+#define OP_CLASS_FIFO 0 //high/low queues (default)
+#define OP_CLASS_SJF  1 //min-heap ordered by predicted remaining burst
+
+//op_add status when a ready queue is over its watermark and the process was NOT added
+#define OP_THROTTLED -2
+
+//bursts shorter than this fraction of the quantum count as interactive (1/4)
+#define INTERACTIVE_SHIFT 2
+
+//weight of the newest burst in the running average is 1/(2^BURST_SHIFT)
+#define BURST_SHIFT 1
+
+/*
+ * Admission limits for one ready queue.
+ * -once the queue holds high_mark processes op_add throttles until it drains to low_mark
+ * -critical processes may go reserve processes past high_mark, even while throttled
+ * -high_mark of 0 means unbounded
+ */
+typedef struct op_watermark_struct {
+	int high_mark;
+	int low_mark;
+	int reserve;
+	int throttled; //1 while op_add is refusing non-critical processes
+} Op_watermark_s;
+
+/*
+ * Queue wrapper: the original queue followed by its last process and critical count (both
+ * OP_ENGINE_TAIL only).
+ * base.count only counts the processes in the list, op_get_count adds the spilled ones.
+ */
+typedef struct op_queue_ext_struct {
+	Op_queue_s base; //MUST be first
+	Op_process_s *tail;
+	int crit_count;                //critical processes in the list (searches for one stop at 0, OP_ENGINE_TAIL only)
+	struct op_spill_struct *spill; //overflow store of a spilling low queue, NULL for none (op_set_spill)
+	Op_watermark_s limits;         //admission limits (ready queues only, op_set_watermarks)
+} Op_queue_ext_s;
+
+/*
+ * Scheduling stats aggregated over every live process that shares a command.
+ */
+typedef struct op_cmd_stats_struct {
+	unsigned long long run_total_ns; //cpu time charged to processes running this command
+	unsigned int bursts;             //number of charges to processes running this command
+	unsigned int processes;          //live processes currently sharing the command
+	unsigned long long burst_avg_ns; //exponentially averaged length of its completed bursts (SJF prediction)
+} Op_cmd_stats_s;
+
+/*
+ * Process wrapper: the original process followed by its runtime accounting.
+ */
+typedef struct op_process_ext_struct {
+	Op_process_s base; //MUST be first
+
+	unsigned int cmd_id; //id of base.cmd in the command intern table
+	unsigned int group;  //process group it is scheduled in (0 = ungrouped)
+	unsigned int gang;   //gang it is co-scheduled with (0 = none)
+
+	unsigned long long run_total_ns; //cumulative cpu time charged to the process
+	unsigned long long burst_avg_ns; //exponentially averaged burst length
+	unsigned long long quantum_ns;   //time slice the dispatcher should give it next
+	unsigned int bursts;             //number of charges so far
+
+	unsigned int sched_class;        //OP_CLASS_*
+	unsigned long long burst_run_ns; //cpu time used so far in the current (unfinished) burst
+	unsigned long long sjf_key;      //predicted remaining burst when it was added (0 once starving)
+	unsigned long long sjf_seq;      //order it was added in, breaks ties FIFO
+} Op_process_ext_s;
+
+//called when a throttled ready queue drains to its low watermark
+typedef void (*Op_capacity_cb)(Op_schedule_s *schedule, Op_queue_s *queue, void *arg);
+
+/*
+ * Counters kept for every process group.
+ */
+typedef struct op_group_stats_struct {
+	unsigned long long added;      //processes accepted by op_add
+	unsigned long long dispatched; //processes handed out by op_select (and op_select_group/op_select_gang)
+	unsigned long long promoted;   //low processes aged into the group's high queue
+	unsigned long long exited;     //processes that exited or were terminated
+} Op_group_stats_s;
+
+/*
+ * Process group (tenant) with its own ready queues and a share of the dispatches.
+ * Groups with ready processes form a circular list that op_select walks
+ * deficit round robin style: each turn a group gets shares dispatches.
+ */
+typedef struct op_group_struct {
+	Op_queue_s *high;  //group 0 uses the schedule's ready_queue_high/low
+	Op_queue_s *low;
+	int shares;        //dispatches per round
+	int deficit;       //dispatches left in the group's current turn
+	int high_credit;   //picks left in the group's current op_select round, per class
+	int sjf_credit;
+	int low_credit;
+	int prev;          //neighbours in the list of groups with ready processes, -1 when not in it
+	int next;
+	Op_group_stats_s stats;
+} Op_group_s;
+
+/*
+ * Slot of the set of gangs promote_queue promotes as a unit on one pass.
+ */
+typedef struct op_gang_mark_struct {
+	unsigned int gang;
+	unsigned int stamp; //pass that marked it, slots from other passes are empty
+} Op_gang_mark_s;
+
+/*
+ * Schedule wrapper: the original schedule followed by scheduler-wide state.
+ */
+typedef struct op_schedule_ext_struct {
+	Op_schedule_s base; //MUST be first
+
+	Op_capacity_cb capacity_cb; //NULL for none
+	void *capacity_arg;
+	int capacity_fd;            //eventfd bumped when capacity frees up, -1 for none
+
+	Op_trace_rec_s *trace_ring; //ring of scheduling decisions, NULL while tracing is off
+	unsigned int trace_mask;    //ring size - 1 (ring size is a power of 2)
+	unsigned long long trace_head;        //slots handed out so far
+	unsigned long long trace_start_ticks; //clock samples from when tracing was enabled
+	unsigned long long trace_start_ns;
+
+	Op_group_s groups[OP_MAX_GROUPS];
+	int group_count;   //groups created so far (group 0 always exists)
+	int group_current; //group whose turn it is, -1 when no group has ready processes
+
+	Op_process_s **sjf_heap;     //SJF class ready processes, min-heap on (sjf_key, sjf_seq)
+	int sjf_count;
+	int sjf_capacity;
+	unsigned long long sjf_seq;  //next sjf_seq to hand out
+
+	int high_weight;  //op_select hands out high_weight high processes, sjf_weight SJF ones (group 0)
+	int low_weight;   //and low_weight low ones per round of a group
+	int sjf_weight;
+
+	Op_gang_mark_s *gang_marks;  //gangs with a starving member, open addressing (NULL until first needed)
+	unsigned int gang_mark_mask; //table size - 1 (a power of 2)
+	unsigned int gang_stamp;     //stamp of the current promote_queue pass
+} Op_schedule_ext_s;
+
+//casts between the starter structs and their wrappers
+#define PROC_EXT(process)   ((Op_process_ext_s *)(process))
+#define QUEUE_EXT(queue)    ((Op_queue_ext_s *)(queue))
+#define SCHED_EXT(schedule) ((Op_schedule_ext_s *)(schedule))
+
+//freeing a process that isn't in a queue (releases its command too)
+void op_free_process(Op_process_s *process);
+
+//runtime accounting and adaptive quantum
+int op_charge(Op_process_s *process, unsigned long long ns);
+unsigned long long op_get_quantum(Op_process_s *process);
+
+/* Command intern table (base.cmd is shared and must never be written or freed by callers).
+ * - the table is global to the program, not per schedule (op_new_process interns the command
+ *   before the process belongs to any schedule), so every schedule shares it
+ * - it has no locking and most op_* calls touch it (creating, adding, charging, spilling,
+ *   exporting and freeing processes), so callers running schedules from several threads must
+ *   serialize their op_* calls across ALL schedules (op_sim holds sim_lock around every one)
+ */
+unsigned int op_get_cmd_id(Op_process_s *process);
+int op_cmd_stats(unsigned int cmd_id, Op_cmd_stats_s *stats);
+
+//admission control for the ready queues
+int op_set_watermarks(Op_schedule_s *schedule, Op_queue_s *queue, int high_mark, int low_mark, int reserve);
+int op_set_capacity_cb(Op_schedule_s *schedule, Op_capacity_cb cb, void *arg);
+int op_set_capacity_fd(Op_schedule_s *schedule, int fd);
+
+//binary trace of scheduling decisions
+int op_trace_enable(Op_schedule_s *schedule, unsigned int capacity_log2);
+long long op_trace_dump(Op_schedule_s *schedule, FILE *out);
+
+//group fair-share
+int op_group_create(Op_schedule_s *schedule, int shares);
+int op_set_group(Op_process_s *process, unsigned int group);
+Op_process_s *op_select_group(Op_schedule_s *schedule);
+Op_queue_s *op_get_group_queue(Op_schedule_s *schedule, unsigned int group, int is_low);
+int op_group_stats(Op_schedule_s *schedule, unsigned int group, Op_group_stats_s *stats);
+
+//gang co-scheduling
+int op_set_gang(Op_process_s *process, unsigned int gang);
+int op_select_gang(Op_schedule_s *schedule, Op_process_s **selected, int max);
+
+//unified selection: groups by fair share, then high:SJF:low by weight within a group
+int op_set_select_ratio(Op_schedule_s *schedule, int high_weight, int low_weight);
+int op_set_sjf_weight(Op_schedule_s *schedule, int sjf_weight);
+Op_process_s *op_select(Op_schedule_s *schedule);
+
+//export (and removal) of the defunct queue
+long long op_export_defunct(Op_schedule_s *schedule, FILE *out, int format);
+
+//overflow store for a deep low queue
+int op_set_spill(Op_schedule_s *schedule, int window, const char *dir);
+int op_add_owned(Op_schedule_s *schedule, Op_process_s *process);
+
+//shortest job first class
+int op_set_class(Op_process_s *process, unsigned int sched_class);
+Op_process_s *op_select_sjf(Op_schedule_s *schedule);
+
+#endif
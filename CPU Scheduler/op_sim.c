@@ -0,0 +1,480 @@
+/* Large scale scheduler simulation with simulated processes as coroutines.
+ *
+ * Usage: op_sim [-n tasks] [-t threads] [-b bursts] [-i interactive%] [-s stack_kb] [-w spin]
+ *
+ * - every simulated process is a stackful coroutine with its own small stack
+ *   (hand-rolled context switch on x86-64, ucontext anywhere else)
+ * - a few OS threads dispatch them through the op_* scheduler, one lock around every op_* call
+ * - interactive tasks run short cpu bursts separated by io waits, batch tasks run long bursts
+ * - time is virtual: a task's cpu burst is a number of work units of SIM_UNIT_NS each,
+ *   and its quantum (op_get_quantum) is converted to units when it is dispatched
+ * - a task keeps its stack from its first dispatch until it finishes, so nearly every dispatch
+ *   touches a cold stack page: dispatches/s drops as the task count grows past the caches
+ *
+ * Build next to the scheduler:
+ *   cc -O2 -pthread op_sim.c "Scheduling Project.c" -o op_sim
+ * (or make op_sim, which builds against the stand-in starter headers in stub/)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+#include "op_sched.h"
+#include "op_sched_ext.h"
+
+//virtual length of one unit of simulated cpu work
+#define SIM_UNIT_NS 100000ULL // 0.1ms
+
+//dispatches between scheduler ticks (aging and io completions)
+#define SIM_TICK_DISPATCHES 1024
+
+//io wait lengths are in ticks, io completions are kept in a wheel this big
+#define SIM_WHEEL 64
+
+//why a task handed control back to its worker
+#define SIM_PREEMPTED 0
+#define SIM_BLOCKED   1
+#define SIM_DONE      2
+
+/*
+ * One simulated process.
+ */
+typedef struct sim_task {
+	void *sp;                //saved stack pointer while switched out (x86-64)
+#if !defined(__x86_64__)
+	ucontext_t ctx;
+#endif
+	char *stack;             //NULL until first dispatched, given back when done
+	Op_process_s *process;
+	unsigned int bursts_left;
+	unsigned int burst_units;   //cpu work per burst
+	unsigned int units_left;    //cpu work left in the current burst
+	unsigned int slice_units;   //units it may run before it's preempted
+	unsigned int ran_units;     //units it ran since it was dispatched
+	unsigned int io_ticks;      //ticks each io wait lasts
+	unsigned int status;        //SIM_* reason it switched out
+	unsigned int interactive;
+	unsigned long long finish_tick;
+	struct sim_task *next_io;   //next task in the same io wheel slot
+} sim_task;
+
+/*
+ * Per worker thread state.
+ */
+typedef struct sim_worker {
+	void *sp; //worker's own stack pointer while a task runs
+#if !defined(__x86_64__)
+	ucontext_t ctx;
+#endif
+	sim_task *current;
+	pthread_t thread;
+} sim_worker;
+
+//settings
+static unsigned int n_tasks = 100000;
+static unsigned int n_threads = 4;
+static unsigned int n_bursts = 8;
+static unsigned int interactive_pct = 50;
+static size_t stack_size = 16 * 1024;
+static unsigned int spin = 1;
+
+//shared simulation state, everything below is protected by sim_lock
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static Op_schedule_s *schedule = NULL;
+static sim_task *tasks = NULL;
+static sim_task *io_wheel[SIM_WHEEL];
+static unsigned int io_waiting = 0;
+static unsigned long long tick = 0;
+static unsigned long long dispatches = 0;
+static unsigned int finished = 0;
+
+//stack pool: one big lazily backed mapping, free slots in a stack of indexes
+static char *stack_region = NULL;
+static unsigned int *free_stacks = NULL;
+static unsigned int free_stack_count = 0;
+
+//worker running on this thread (read through current_worker(), tasks move between threads)
+static __thread sim_worker *self = NULL;
+
+//helper prototypes
+void sim_switch(void **save_sp, void *load_sp);
+sim_worker *current_worker() __attribute__((noinline));
+void sim_entry();
+void sim_yield(unsigned int status);
+void sim_burn(unsigned int units);
+void sim_start(sim_worker *worker, sim_task *task);
+void sim_resume(sim_worker *worker, sim_task *task);
+void sim_tick();
+void *sim_worker_main(void *arg);
+unsigned long long now_ns();
+
+#if defined(__x86_64__)
+/*
+ * Saves the callee-saved registers on the current stack, stores the stack pointer
+ * in *save_sp, switches to load_sp and pops the registers saved there.
+ */
+__asm__(
+	".text\n"
+	".globl sim_switch\n"
+	".type sim_switch, @function\n"
+	"sim_switch:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size sim_switch, .-sim_switch\n"
+);
+#endif
+
+/*
+ * HELPER
+ * Monotonic clock in ns.
+ */
+unsigned long long now_ns(){
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * HELPER
+ * Returns the worker of the calling thread. Out of line so a task resumed on
+ * another thread never reuses a thread-local address cached before it switched out.
+ */
+sim_worker *current_worker(){
+
+	__asm__ __volatile__("" ::: "memory");
+	return self;
+}
+
+/*
+ * HELPER
+ * Burns units of simulated cpu work.
+ */
+void sim_burn(unsigned int units){
+
+	for(unsigned long long i = 0; i < (unsigned long long)units * spin; i++){
+		__asm__ __volatile__("" ::: "memory");
+	}
+}
+
+/*
+ * HELPER
+ * Switches from the running task back to its worker.
+ */
+void sim_yield(unsigned int status){
+
+	sim_worker *worker = current_worker();
+	sim_task *task = worker->current;
+	task->status = status;
+
+#if defined(__x86_64__)
+	sim_switch(&task->sp, worker->sp);
+#else
+	swapcontext(&task->ctx, &worker->ctx);
+#endif
+}
+
+/*
+ * HELPER
+ * Body of every task: bursts of cpu work (cut into slices by its quantum)
+ * separated by io waits. Never returns, the last switch out is SIM_DONE.
+ */
+void sim_entry(){
+
+	sim_task *task = current_worker()->current;
+
+	while(task->bursts_left > 0){
+
+		task->units_left = task->burst_units;
+
+		while(task->units_left > 0){
+
+			unsigned int units = task->units_left < task->slice_units ? task->units_left : task->slice_units;
+
+			sim_burn(units);
+			task->ran_units += units;
+			task->units_left -= units;
+
+			//slice used up with work left -> preempted
+			if(task->units_left > 0){
+				sim_yield(SIM_PREEMPTED); //may be resumed on another worker
+			}
+		}
+
+		task->bursts_left--;
+
+		if(task->bursts_left > 0){
+			sim_yield(SIM_BLOCKED);
+		}
+	}
+
+	sim_yield(SIM_DONE);
+}
+
+/*
+ * HELPER
+ * Gives a task a stack and runs it from the start.
+ */
+void sim_start(sim_worker *worker, sim_task *task){
+
+	//stack slots are handed out under sim_lock by the caller
+#if defined(__x86_64__)
+	//initial frame popped by sim_switch: 6 registers, then the "return address" sim_entry,
+	//placed so the stack is 16 byte aligned (minus the return address) when sim_entry starts
+	void **frame = (void **)(task->stack + stack_size);
+
+	*--frame = NULL;
+	*--frame = (void *)sim_entry;
+	for(int reg = 0; reg < 6; reg++){
+		*--frame = NULL;
+	}
+
+	task->sp = frame;
+	sim_switch(&worker->sp, task->sp);
+#else
+	getcontext(&task->ctx);
+	task->ctx.uc_stack.ss_sp = task->stack;
+	task->ctx.uc_stack.ss_size = stack_size;
+	task->ctx.uc_link = NULL;
+	makecontext(&task->ctx, sim_entry, 0);
+	swapcontext(&worker->ctx, &task->ctx);
+#endif
+}
+
+/*
+ * HELPER
+ * Switches back into a task that yielded earlier.
+ */
+void sim_resume(sim_worker *worker, sim_task *task){
+
+#if defined(__x86_64__)
+	sim_switch(&worker->sp, task->sp);
+#else
+	swapcontext(&worker->ctx, &task->ctx);
+#endif
+}
+
+/*
+ * HELPER (sim_lock held)
+ * Advances simulated time by one tick: ages the low queue and
+ * puts tasks whose io finished back in the ready queues.
+ */
+void sim_tick(){
+
+	tick++;
+	op_promote_processes(schedule);
+
+	sim_task *task = io_wheel[tick % SIM_WHEEL];
+	io_wheel[tick % SIM_WHEEL] = NULL;
+
+	while(task != NULL){
+
+		sim_task *next = task->next_io;
+		task->next_io = NULL;
+		io_waiting--;
+		op_add(schedule, task->process);
+		task = next;
+	}
+}
+
+/*
+ * Worker thread: dispatch, run the task until it switches out, account for it, repeat.
+ */
+void *sim_worker_main(void *arg){
+
+	sim_worker *worker = arg;
+	self = worker;
+
+	pthread_mutex_lock(&sim_lock);
+
+	while(finished < n_tasks){
+
+		Op_process_s *process = op_select(schedule);
+
+		//nothing ready: if tasks are only waiting on io, move time forward, otherwise let others run
+		if(process == NULL){
+
+			if(io_waiting > 0){
+				sim_tick();
+			}
+			else{
+				pthread_mutex_unlock(&sim_lock);
+				sched_yield();
+				pthread_mutex_lock(&sim_lock);
+			}
+			continue;
+		}
+
+		sim_task *task = &tasks[process->pid];
+		int first_run = task->stack == NULL;
+
+		if(first_run){
+			task->stack = stack_region + (size_t)free_stacks[--free_stack_count] * stack_size;
+		}
+
+		//quantum -> slice of work units (always at least one)
+		task->slice_units = op_get_quantum(process) / SIM_UNIT_NS;
+		if(task->slice_units == 0){
+			task->slice_units = 1;
+		}
+		task->ran_units = 0;
+
+		if(++dispatches % SIM_TICK_DISPATCHES == 0){
+			sim_tick();
+		}
+
+		pthread_mutex_unlock(&sim_lock);
+
+		worker->current = task;
+		if(first_run){
+			sim_start(worker, task);
+		}
+		else{
+			sim_resume(worker, task);
+		}
+
+		pthread_mutex_lock(&sim_lock);
+
+		op_charge(process, task->ran_units * SIM_UNIT_NS);
+
+		if(task->status == SIM_PREEMPTED){
+			op_add(schedule, process);
+		}
+		else if(task->status == SIM_BLOCKED){
+			unsigned long long wake = tick + task->io_ticks;
+			task->next_io = io_wheel[wake % SIM_WHEEL];
+			io_wheel[wake % SIM_WHEEL] = task;
+			io_waiting++;
+		}
+		else{
+			//done -> hand its stack back and retire it
+			free_stacks[free_stack_count++] = (task->stack - stack_region) / stack_size;
+			task->stack = NULL;
+			task->finish_tick = tick;
+			op_exited(schedule, process, 0);
+			finished++;
+		}
+	}
+
+	pthread_mutex_unlock(&sim_lock);
+	return NULL;
+}
+
+int main(int argc, char *argv[]){
+
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:t:b:i:s:w:")) != -1){
+
+		switch(opt){
+			case 'n': n_tasks = strtoul(optarg, NULL, 10); break;
+			case 't': n_threads = strtoul(optarg, NULL, 10); break;
+			case 'b': n_bursts = strtoul(optarg, NULL, 10); break;
+			case 'i': interactive_pct = strtoul(optarg, NULL, 10); break;
+			case 's': stack_size = strtoul(optarg, NULL, 10) * 1024; break;
+			case 'w': spin = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n tasks] [-t threads] [-b bursts] [-i interactive%%] [-s stack_kb] [-w spin]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(n_tasks == 0 || n_threads == 0 || n_bursts == 0 || stack_size < 4096){
+		fprintf(stderr, "%s: tasks, threads and bursts must be positive, stacks at least 4kb\n", argv[0]);
+		return 1;
+	}
+
+	schedule = op_create();
+	tasks = calloc(n_tasks, sizeof(sim_task));
+	free_stacks = malloc(sizeof(unsigned int) * n_tasks);
+
+	//stacks are only backed by memory once a task touches them
+	stack_region = mmap(NULL, (size_t)n_tasks * stack_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if(schedule == NULL || tasks == NULL || free_stacks == NULL || stack_region == MAP_FAILED){
+		fprintf(stderr, "%s: out of memory\n", argv[0]);
+		return 1;
+	}
+
+	for(unsigned int i = 0; i < n_tasks; i++){
+		free_stacks[i] = n_tasks - 1 - i;
+	}
+	free_stack_count = n_tasks;
+
+	//interactive: 0.2-1ms bursts and 1-4 tick io waits, batch: 20-80ms bursts and no real io
+	srandom(1);
+
+	for(unsigned int i = 0; i < n_tasks; i++){
+
+		sim_task *task = &tasks[i];
+
+		task->interactive = (unsigned int)(random() % 100) < interactive_pct;
+		task->bursts_left = n_bursts;
+		task->burst_units = task->interactive ? 2 + random() % 9 : 200 + random() % 601;
+		task->io_ticks = task->interactive ? 1 + random() % 4 : 1;
+		//builds without the low queue (OP_FEATURE_LOW 0) run batch tasks in the high queue
+		task->process = op_new_process(task->interactive ? "interactive" : "batch", i, !task->interactive && OP_FEATURE_LOW, 0);
+
+		if(task->process == NULL || op_add(schedule, task->process) != 0){
+			fprintf(stderr, "%s: could not create task %u\n", argv[0], i);
+			return 1;
+		}
+	}
+
+	sim_worker *workers = calloc(n_threads, sizeof(sim_worker));
+	unsigned long long start = now_ns();
+
+	for(unsigned int i = 0; i < n_threads; i++){
+		pthread_create(&workers[i].thread, NULL, sim_worker_main, &workers[i]);
+	}
+	for(unsigned int i = 0; i < n_threads; i++){
+		pthread_join(workers[i].thread, NULL);
+	}
+
+	double seconds = (now_ns() - start) / 1e9;
+
+	//turnaround in ticks per class
+	unsigned long long turnaround[2] = {0, 0};
+	unsigned int count[2] = {0, 0};
+
+	for(unsigned int i = 0; i < n_tasks; i++){
+		turnaround[tasks[i].interactive] += tasks[i].finish_tick;
+		count[tasks[i].interactive]++;
+	}
+
+	printf("tasks %u  threads %u  dispatches %llu  ticks %llu\n", n_tasks, n_threads, dispatches, tick);
+	printf("wall %.3fs  %.0f dispatches/s\n", seconds, dispatches / seconds);
+	printf("mean turnaround (ticks): interactive %.1f  batch %.1f\n",
+		count[1] ? (double)turnaround[1] / count[1] : 0.0, count[0] ? (double)turnaround[0] / count[0] : 0.0);
+
+	op_deallocate(schedule);
+	munmap(stack_region, (size_t)n_tasks * stack_size);
+	free(free_stacks);
+	free(tasks);
+	free(workers);
+
+	return 0;
+}
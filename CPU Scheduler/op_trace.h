@@ -0,0 +1,63 @@
+/* Binary trace of scheduling decisions.
+ * - Each schedule can keep a ring of fixed size records (see op_trace_enable).
+ * - op_trace_dump writes an Op_trace_header_s followed by the records, oldest first.
+ * - op_trace2json turns a dump into Chrome trace / Perfetto JSON.
+ */
+
+#ifndef OP_TRACE_H
+#define OP_TRACE_H
+
+#include <stdint.h>
+
+//first 8 bytes of every dump
+#define OP_TRACE_MAGIC "OPTRACE1"
+#define OP_TRACE_VERSION 1
+
+//what the scheduler did
+#define OP_TRACE_ADD        0
+#define OP_TRACE_SELECT     1
+#define OP_TRACE_PROMOTE    2
+#define OP_TRACE_EXITED     3
+#define OP_TRACE_TERMINATED 4
+#define OP_TRACE_THROTTLED  5
+#define OP_TRACE_LOST       255 //dump placeholder for a record overwritten while it was being dumped
+
+//which queue the process ended up in (or was taken from for selections)
+#define OP_TRACE_Q_HIGH    0
+#define OP_TRACE_Q_LOW     1
+#define OP_TRACE_Q_DEFUNCT 2
+#define OP_TRACE_Q_NONE    3
+#define OP_TRACE_Q_SJF     4
+
+/*
+ * One scheduling decision (24 bytes).
+ * seq is 0 while the record is being written and is written last, so a record whose seq
+ * doesn't match its slot is still being written (or was overwritten).
+ */
+typedef struct op_trace_rec_struct {
+	uint64_t ticks;  //raw clock ticks (see Op_trace_header_s for the conversion to ns)
+	uint32_t seq;    //low 32 bits of (slot number + 1)
+	int32_t pid;
+	uint32_t state;  //process state bits after the operation
+	uint8_t op;      //OP_TRACE_*
+	uint8_t queue;   //OP_TRACE_Q_*
+	uint16_t pad;
+} Op_trace_rec_s;
+
+/*
+ * Dump header. The two (ticks, ns) clock samples taken when tracing was enabled
+ * and when the dump was written convert record ticks to nanoseconds.
+ */
+typedef struct op_trace_header_struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t rec_size;
+	uint64_t count;      //number of records that follow
+	uint64_t dropped;    //records overwritten (or still being written) at dump time
+	uint64_t start_ticks;
+	uint64_t start_ns;
+	uint64_t end_ticks;
+	uint64_t end_ns;
+} Op_trace_header_s;
+
+#endif
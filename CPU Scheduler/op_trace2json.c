@@ -0,0 +1,177 @@
+/* Converts a scheduler trace dump (see op_trace.h) to Chrome trace / Perfetto JSON.
+ *
+ * Usage: op_trace2json <trace.bin> [out.json]
+ *        (writes to stdout when no output file is given)
+ *
+ * - every record becomes an instant event on its queue's track
+ * - each selection opens a dispatch slice on the process' own track that ends
+ *   at the next record for the same pid (re-add, exit or termination)
+ * - load the output in chrome://tracing or ui.perfetto.dev
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "op_trace.h"
+
+//Chrome trace "processes" used to group the tracks
+#define QUEUE_TRACKS 1
+#define DISPATCH_TRACKS 2
+
+/*
+ * Dispatch slice of one pid: when it was selected, and from which queue.
+ * A slot stays claimed by its pid once used so probe chains never break.
+ */
+typedef struct open_slice {
+	int32_t pid;
+	int used;     //slot belongs to pid
+	int running;  //pid was selected and hasn't shown up since
+	double start_us;
+	uint8_t queue;
+} open_slice;
+
+const char *op_names[] = {"add", "select", "promote", "exited", "terminated", "throttled"};
+const char *queue_names[] = {"high queue", "low queue", "defunct queue", "rejected", "sjf heap"};
+
+//helper prototypes
+open_slice *find_slice(open_slice *slices, unsigned int mask, int32_t pid);
+void end_slice(FILE *out, open_slice *slice, double now_us);
+
+/*
+ * HELPER
+ * Finds (or claims) the slot for pid in the open addressing table of dispatch slices
+ * (mask + 1 is a power of 2 larger than the number of records, so it never fills).
+ */
+open_slice *find_slice(open_slice *slices, unsigned int mask, int32_t pid){
+
+	unsigned int slot = ((uint32_t)pid * 2654435761u) & mask;
+
+	while(slices[slot].used && slices[slot].pid != pid){
+		slot = (slot + 1) & mask;
+	}
+
+	slices[slot].used = 1;
+	slices[slot].pid = pid;
+	return &slices[slot];
+}
+
+/*
+ * HELPER
+ * Writes the dispatch slice that's open in slice as a complete ("X") event ending at now_us.
+ */
+void end_slice(FILE *out, open_slice *slice, double now_us){
+
+	fprintf(out, ",\n{\"name\":\"run (%s)\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+		queue_names[slice->queue], slice->start_us, now_us - slice->start_us, DISPATCH_TRACKS, slice->pid);
+
+	slice->running = 0;
+}
+
+int main(int argc, char *argv[]){
+
+	if(argc < 2 || argc > 3){
+		fprintf(stderr, "usage: %s <trace.bin> [out.json]\n", argv[0]);
+		return 1;
+	}
+
+	FILE *in = fopen(argv[1], "rb");
+	if(in == NULL){
+		perror(argv[1]);
+		return 1;
+	}
+
+	FILE *out = argc == 3 ? fopen(argv[2], "w") : stdout;
+	if(out == NULL){
+		perror(argv[2]);
+		return 1;
+	}
+
+	//check the header before trusting any sizes in it
+	Op_trace_header_s header;
+
+	if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, OP_TRACE_MAGIC, sizeof(header.magic)) != 0){
+		fprintf(stderr, "%s: not a scheduler trace\n", argv[1]);
+		return 1;
+	}
+
+	if(header.version != OP_TRACE_VERSION || header.rec_size != sizeof(Op_trace_rec_s)){
+		fprintf(stderr, "%s: unsupported trace version %u\n", argv[1], header.version);
+		return 1;
+	}
+
+	//ticks -> microseconds from the two clock samples in the header
+	double us_per_tick = 0.001;
+
+	if(header.end_ticks > header.start_ticks){
+		us_per_tick = (double)(header.end_ns - header.start_ns) / (double)(header.end_ticks - header.start_ticks) / 1000.0;
+	}
+
+	//table of open dispatch slices, at least twice as big as the number of records
+	unsigned int size = 16;
+
+	while(size < header.count * 2 && size < (1u << 30)){
+		size <<= 1;
+	}
+
+	open_slice *slices = calloc(size, sizeof(open_slice));
+	if(slices == NULL){
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	//track names
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%llu},\"traceEvents\":[", (unsigned long long)header.dropped);
+	fprintf(out, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"queues\"}}", QUEUE_TRACKS);
+	fprintf(out, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"dispatch\"}}", DISPATCH_TRACKS);
+
+	for(int queue = OP_TRACE_Q_HIGH; queue <= OP_TRACE_Q_SJF; queue++){
+		fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			QUEUE_TRACKS, queue, queue_names[queue]);
+	}
+
+	double now_us = 0;
+	Op_trace_rec_s rec;
+
+	for(unsigned long long i = 0; i < header.count && fread(&rec, sizeof(rec), 1, in) == 1; i++){
+
+		if(rec.op > OP_TRACE_THROTTLED || rec.queue > OP_TRACE_Q_SJF){
+			continue;
+		}
+
+		now_us = (double)(int64_t)(rec.ticks - header.start_ticks) * us_per_tick;
+
+		//instant event on the queue's track
+		fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"pid\":%d,\"state\":\"0x%08x\"}}",
+			op_names[rec.op], now_us, QUEUE_TRACKS, rec.queue, rec.pid, rec.state);
+
+		//any record for a dispatched pid ends its run, a selection starts a new one
+		open_slice *slice = find_slice(slices, size - 1, rec.pid);
+
+		if(slice->running){
+			end_slice(out, slice, now_us);
+		}
+
+		if(rec.op == OP_TRACE_SELECT){
+			slice->running = 1;
+			slice->start_us = now_us;
+			slice->queue = rec.queue;
+		}
+	}
+
+	//processes still running at the end of the trace
+	for(unsigned int slot = 0; slot < size; slot++){
+		if(slices[slot].running){
+			end_slice(out, &slices[slot], now_us);
+		}
+	}
+
+	fprintf(out, "\n]}\n");
+
+	free(slices);
+	fclose(in);
+	if(out != stdout){
+		fclose(out);
+	}
+
+	return 0;
+}
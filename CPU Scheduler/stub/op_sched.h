@@ -0,0 +1,42 @@
+/* Stand-in for the starter code's op_sched.h, so the tools here build outside the course tree.
+ * - same structs and prototypes the scheduler relies on (op_sched_ext.h wraps the structs,
+ *   so their layout has to match the starter header's)
+ * - point the include path at the real starter headers instead when they're available
+ */
+
+#ifndef OP_SCHED_H
+#define OP_SCHED_H
+
+#include <sys/types.h>
+
+typedef struct op_process_struct {
+	unsigned int state;
+	char *cmd;
+	pid_t pid;
+	int age;
+	struct op_process_struct *next;
+} Op_process_s;
+
+typedef struct op_queue_struct {
+	Op_process_s *head;
+	int count;
+} Op_queue_s;
+
+typedef struct op_schedule_struct {
+	Op_queue_s *ready_queue_high;
+	Op_queue_s *ready_queue_low;
+	Op_queue_s *defunct_queue;
+} Op_schedule_s;
+
+Op_schedule_s *op_create();
+Op_process_s *op_new_process(char *command, pid_t pid, int is_low, int is_critical);
+int op_add(Op_schedule_s *schedule, Op_process_s *process);
+int op_get_count(Op_queue_s *queue);
+Op_process_s *op_select_high(Op_schedule_s *schedule);
+Op_process_s *op_select_low(Op_schedule_s *schedule);
+int op_promote_processes(Op_schedule_s *schedule);
+int op_exited(Op_schedule_s *schedule, Op_process_s *process, int exit_code);
+int op_terminated(Op_schedule_s *schedule, pid_t pid, int exit_code);
+void op_deallocate(Op_schedule_s *schedule);
+
+#endif
@@ -0,0 +1 @@
+/* Stand-in for the starter code's vm_process.h (the scheduler uses nothing from it). */
@@ -20,12 +20,17 @@
 #include <synch.h>
 #include <kern/errno.h>
 #include <machine/spl.h>
+#include <clock.h>
 
 
 /*
  * Constants 
  */
-#define NVEHICLES 20 
+#define NVEHICLES 20 //default number of vehicles (sp [vehicles [truck%] [laneA laneB laneC]])
+#define TRUCK_PERCENT 50 //default share of trucks
+#define PLATOON_SIZE 1 //default most vehicles crossing per section acquisition (1 = no platoons)
+#define STRATEGY_LOCKS 0 //vehicles race for the section locks
+#define STRATEGY_SIGNAL 1 //a controller thread lets compatible movements in phase by phase
 #define RIGHT 0
 #define LEFT 1
 #define CAR 0
@@ -44,7 +49,13 @@
 static struct lock *lt_AB = NULL; 
 static struct lock *lt_BC = NULL;
 static struct lock *lt_CA = NULL;
-static struct lock *left_lock=NULL;
+
+/*
+ * Left turns hold their first section while they wait for the second one. Three of them doing
+ * that (one per lane) would wait on each other in a circle, so at most two get to try at once.
+ */
+#define LEFT_SEATS 2
+static struct semaphore *left_seats = NULL;
 
 /*
  * Locks that block future trucks from proceeding for each lane
@@ -57,38 +68,147 @@ static struct lock *truck_lock_C= NULL;
 
 
 /*
- * Restricts access to global array of cars that have yet to finish a turn
+ * Trucks in each lane wait on their lane's cv (with car_arr_lock) until the lane has no cars
  */
-static struct lock *total_car_lock = NULL; //Total vehicle remain bodyguard
-static struct lock *car_arr_lock = NULL; // Each exit count bodyguard
+static struct lock *car_arr_lock = NULL;
+static struct cv *lane_cv[3] = {NULL, NULL, NULL};
 
 
 /*
- * Vehicle count.
+ * Counts the vehicles down to 0, createvehicles waits on it for the run to finish.
  */
-static volatile int vehicles_remaining;
+static struct latch *vehicles_left = NULL;
 
 /*
  * Represents number of cars in each lane that have not yet completed a turn
  */
-static int num_cars_waiting[3]={0,0,0}; //Keep track of count in each lanes.
+static struct atomic num_cars_waiting[3]; //Keep track of count in each lanes.
+
+/*
+ * Run settings (see createvehicles): how many vehicles, how many of them trucks and how they spread over the lanes.
+ */
+static unsigned long nvehicles = NVEHICLES;
+static int truck_percent = TRUCK_PERCENT;
+static int lane_weight[3] = {1, 1, 1};
+static int platoon_size = PLATOON_SIZE;
+
+/*
+ * A vehicle crossing the intersection. Vehicles of the same route (lane and turn) cross in
+ * platoons: the leader gets the sections once and takes up to platoon_size-1 queued followers
+ * through with it, linked behind it by next. A vehicle on its own is a platoon of one.
+ */
+struct platoon_member {
+    unsigned long number;
+    unsigned long type;
+    volatile int done; //the leader took it across (set at splhigh)
+    volatile int lead; //the leader handed it the next platoon (set at splhigh)
+    struct platoon_member *next;
+};
+
+/*
+ * Vehicles waiting to follow the leader of a route, oldest first.
+ */
+struct platoon {
+    struct lock *lock; //guards the rest
+    int leading; //a leader is crossing
+    struct platoon_member *head;
+    struct platoon_member *tail;
+};
+static struct platoon platoons[3][2]; //[lane][turn]
+
+/*
+ * Traffic signal (STRATEGY_SIGNAL). A movement is a lane and a turn; each phase is a set of
+ * movements that share no section: all rights, then left A + right C, left B + right A and
+ * left C + right B. The controller gives each phase with vehicles waiting a green that admits
+ * as many vehicles as were waiting (at most PHASE_MAX, so the other phases' wait stays bounded),
+ * then red until the intersection is clear. Vehicles still take the section locks inside, a
+ * section only ever fits one vehicle.
+ */
+#define MOVE(lane, turn) ((lane) * 2 + (turn))
+#define MOVES 6
+#define PHASES 4
+#define PHASE_MAX 16
+
+static const int phase_moves[PHASES] = {
+    (1 << MOVE(LANEA, RIGHT)) | (1 << MOVE(LANEB, RIGHT)) | (1 << MOVE(LANEC, RIGHT)),
+    (1 << MOVE(LANEA, LEFT)) | (1 << MOVE(LANEC, RIGHT)),
+    (1 << MOVE(LANEB, LEFT)) | (1 << MOVE(LANEA, RIGHT)),
+    (1 << MOVE(LANEC, LEFT)) | (1 << MOVE(LANEB, RIGHT)),
+};
+
+static int strategy = STRATEGY_LOCKS;
+static struct lock *signal_lock = NULL; //guards everything below
+static struct cv *gate_cv[MOVES]; //vehicles wait here for their movement's green
+static struct cv *controller_cv = NULL; //the controller waits here for vehicles to arrive or clear
+static struct semaphore *controller_done = NULL; //V'd by the controller when it quits
+static int signal_waiting[MOVES]; //vehicles at each gate
+static int signal_phase; //phase that is green, -1 while red
+static int signal_quota; //vehicles the green phase may still let in
+static int signal_inside; //vehicles let in that haven't left yet
+static int signal_stop; //run is over, controller quits
+
+/*
+ * Event log. Vehicles don't print while they hold sections (a kprintf sleeps until the console
+ * took the line, which made console time lock hold time): every approach, enter and leave goes
+ * into the vehicle's own slots of event_log instead, written only by the vehicle's thread or by
+ * the leader of its platoon while it waits to be taken across, so no locking. After the run
+ * flush_events prints the log in timestamp order.
+ */
+#define EVENTS_PER_VEHICLE 5 //approach, enter and leave two sections for a left turn
+#define NO_SECTION 3
+
+struct vehicle_event {
+    u_int64_t time; //now_ns
+    u_int32_t number;
+    u_int32_t seq; //event_seq when it was logged, for ties
+    u_int8_t type;
+    u_int8_t lane;
+    u_int8_t turn;
+    u_int8_t section; //index in sections, or NO_SECTION
+    u_int8_t phase; //APR, ENT or EXT
+};
+
+static struct lock **const sections[3] = {&lt_AB, &lt_BC, &lt_CA};
+static struct vehicle_event *event_log = NULL; //EVENTS_PER_VEHICLE slots per vehicle
+static u_int8_t *event_count = NULL; //slots each vehicle used
+static struct atomic event_seq; //events logged this run, in the order they were logged
 
 /*
- * Sleep variable for the parent thread, parent thread will sleep on this address until all cars are done
+ * Histogram of vehicle latencies (approach to done) in microseconds: exact below 16us,
+ * then 16 buckets per power of 2 (under 6.25% error), up to 2^31us.
  */
-int mom;
+#define LAT_EXACT 16
+#define LAT_BUCKETS ((31 - 3) * LAT_EXACT)
+static struct atomic latency_hist[LAT_BUCKETS];
+static struct atomic latency_max;
 
 
 /*
  * Function protoypes
  */
 void print_info(long type, long number, long origin, long turn_dir, char *section, int phase);
+void log_event(long type, long number, long origin, long turn_dir, struct lock *section, int phase);
+int event_before(const struct vehicle_event *a, const struct vehicle_event *b);
+void sort_events(struct vehicle_event *events, unsigned long count);
+static void flush_events(void);
 void car_approach(int lane);
+void car_leave(int lane);
 int car_waiting(int lane);
 void direction(unsigned long vehicledirection, unsigned long vehiclenumber, unsigned long vehicletype, int turndirection);
-static void turnright(unsigned long vehicledirection, unsigned long vehiclenumber, unsigned long vehicletype);
-static void turnleft(unsigned long vehicledirection, unsigned long vehiclenumber, unsigned long vehicletype);
-void remove_vehicle();
+static void turnright(unsigned long vehicledirection, struct platoon_member *platoon);
+static void turnleft(unsigned long vehicledirection, struct platoon_member *platoon);
+int platoon_join(int lane, int turn, struct platoon_member *self);
+void platoon_fill(int lane, int turn, struct platoon_member *leader);
+void platoon_done(int lane, int turn, struct platoon_member *leader);
+int phase_demand(int phase);
+void signal_enter(int lane, int turn);
+void signal_leave(void);
+static void signal_controller(void *unused, unsigned long phase);
+int choose_lane(void);
+u_int64_t now_ns(void);
+void record_latency(u_int64_t start);
+unsigned long latency_percentile(unsigned long count, int permille);
+void report_run(u_int64_t elapsed);
 
 /*
  * Displays information about a vehicle approaching, entering, or leaving an intersection space
@@ -125,65 +245,524 @@ void print_info(long type, long number, long origin, long turn_dir, char *sectio
 }
 
 /*
- * remove_vehicle()
- * 
- * Atomically decrements number of vehicles parent thread is waiting on to finish.
+ * log_event()
+ *
+ * Adds an approach, enter or leave of vehicle number to its event log slots (print_info
+ * arguments, with the section as its lock).
+ */
+void log_event(long type, long number, long origin, long turn_dir, struct lock *section, int phase){
+    struct vehicle_event *event;
+    int index;
+
+    assert(event_count[number] < EVENTS_PER_VEHICLE);
+    event = &event_log[number * EVENTS_PER_VEHICLE + event_count[number]];
+
+    index = 0;
+    while (index < 3 && *sections[index] != section){
+        index++;
+    }
+
+    event->time = now_ns();
+    event->number = number;
+    event->type = type;
+    event->lane = origin;
+    event->turn = turn_dir;
+    event->section = section == NULL ? NO_SECTION : index;
+    event->phase = phase;
+    event->seq = (u_int32_t)atomic_add(&event_seq, 1);
+    event_count[number]++;
+}
+
+/*
+ * event_before()
+ *
+ * Returns: true if event a happened before event b. Same time (a coarse clock) goes by the order
+ * they were logged in, which is the order they happened in: a vehicle logs an enter while it holds
+ * the section and a leave before it lets go. The difference is signed so a wrapped seq still sorts.
+ */
+int event_before(const struct vehicle_event *a, const struct vehicle_event *b){
+    if (a->time != b->time){
+        return a->time < b->time;
+    }
+    return (int32_t)(a->seq - b->seq) < 0;
+}
+
+/*
+ * sort_events()
+ *
+ * Heapsorts count events into timestamp order, in place (the log can be big, and this runs in
+ * the kernel, so no second buffer and no recursion).
+ */
+void sort_events(struct vehicle_event *events, unsigned long count){
+    struct vehicle_event swap;
+    unsigned long start, end, root, child;
+
+    //heapify, then move the latest event to the end until the heap is empty
+    for (start = count / 2, end = count; end > 1; ){
+        if (start > 0){
+            start--;
+        }
+        else {
+            end--;
+            swap = events[0];
+            events[0] = events[end];
+            events[end] = swap;
+        }
+
+        //sift events[start] down the heap events[0..end)
+        for (root = start; (child = 2 * root + 1) < end; root = child){
+            if (child + 1 < end && event_before(&events[child], &events[child + 1])){
+                child++;
+            }
+            if (!event_before(&events[root], &events[child])){
+                break;
+            }
+            swap = events[root];
+            events[root] = events[child];
+            events[child] = swap;
+        }
+    }
+}
+
+/*
+ * flush_events()
+ *
+ * Called by createvehicles after the run: prints every vehicle's events, merged in timestamp
+ * order.
+ */
+static void flush_events(void){
+    struct vehicle_event *event;
+    unsigned long vehicle, count = 0;
+    int seq;
+
+    //pack the used slots to the front (never overtakes the slot it reads)
+    for (vehicle = 0; vehicle < nvehicles; vehicle++){
+        for (seq = 0; seq < event_count[vehicle]; seq++){
+            event_log[count++] = event_log[vehicle * EVENTS_PER_VEHICLE + seq];
+        }
+    }
+
+    sort_events(event_log, count);
+
+    for (event = event_log; event < event_log + count; event++){
+        print_info(event->type, event->number, event->lane, event->turn,
+            event->section == NO_SECTION ? NULL : (*sections[event->section])->name, event->phase);
+    }
+}
+
+/*
+ * choose_lane()
+ *
+ * Picks the lane a vehicle comes from, weighted by lane_weight.
+ */
+int choose_lane(void){
+    int pick = random() % (lane_weight[LANEA] + lane_weight[LANEB] + lane_weight[LANEC]);
+
+    if (pick < lane_weight[LANEA]){
+        return LANEA;
+    }
+    if (pick < lane_weight[LANEA] + lane_weight[LANEB]){
+        return LANEB;
+    }
+    return LANEC;
+}
+
+/*
+ * now_ns()
+ *
+ * Current time in nanoseconds.
+ */
+u_int64_t now_ns(void){
+    time_t secs;
+    u_int32_t nsecs;
+
+    gettime(&secs, &nsecs);
+    return (u_int64_t)secs * 1000000000 + nsecs;
+}
+
+/*
+ * record_latency()
+ *
+ * Adds the time since start to the latency histogram (atomically, vehicles finish concurrently).
  */
-void remove_vehicle(){
-   struct lock *vehicle_count;
-    vehicle_count= total_car_lock;
-    assert(vehicle_count!=NULL);
+void record_latency(u_int64_t start){
+    u_int64_t us = (now_ns() - start) / 1000;
+    int top = 4;
+    int max;
+
+    //fits an atomic (over half an hour anyway)
+    if (us > 0x7fffffff){
+        us = 0x7fffffff;
+    }
 
-    //Atomic update to global variable
-    lock_acquire(vehicle_count);
-    vehicles_remaining--; 
-    lock_release(vehicle_count);
+    //exact below LAT_EXACT, else LAT_EXACT buckets per power of 2
+    if (us < LAT_EXACT){
+        atomic_add(&latency_hist[us], 1);
+    }
+    else {
+        while ((us >> (top + 1)) != 0){
+            top++;
+        }
+        atomic_add(&latency_hist[(top - 3) * LAT_EXACT + (int)((us >> (top - 4)) & (LAT_EXACT - 1))], 1);
+    }
+
+    //raise the max unless someone beat us to a bigger one
+    max = atomic_read(&latency_max);
+    while ((u_int64_t)max < us && !atomic_cas(&latency_max, max, (int)us)){
+        max = atomic_read(&latency_max);
+    }
+}
+
+/*
+ * latency_percentile()
+ *
+ * Returns: upper end (in us) of the histogram bucket holding the permille'th latency of count.
+ */
+unsigned long latency_percentile(unsigned long count, int permille){
+    unsigned long rank = (count * permille + 999) / 1000;
+    unsigned long seen = 0;
+    int bucket;
+
+    if (rank == 0){
+        rank = 1;
+    }
+
+    for (bucket = 0; bucket < LAT_BUCKETS; bucket++){
+        seen += (unsigned)atomic_read(&latency_hist[bucket]);
+        if (seen >= rank){
+            break;
+        }
+    }
+
+    if (bucket < LAT_EXACT){
+        return bucket;
+    }
+    if (bucket == LAT_BUCKETS){
+        bucket--;
+    }
+
+    //bucket covers [(LAT_EXACT + sub) << shift, (LAT_EXACT + sub + 1) << shift)
+    return ((unsigned long)(LAT_EXACT + bucket % LAT_EXACT + 1) << (bucket / LAT_EXACT - 1)) - 1;
+}
+
+/*
+ * report_run()
+ *
+ * Prints the throughput and latency percentiles of the run that took elapsed ns.
+ */
+void report_run(u_int64_t elapsed){
+    if (elapsed == 0){
+        elapsed = 1;
+    }
+
+    kprintf("%lu vehicles in %lu ms: %lu vehicles/s\n", nvehicles, (unsigned long)(elapsed / 1000000),
+        (unsigned long)((u_int64_t)nvehicles * 1000000000 / elapsed));
+    kprintf("latency us: p50 %lu p90 %lu p99 %lu p99.9 %lu max %lu\n",
+        latency_percentile(nvehicles, 500), latency_percentile(nvehicles, 900),
+        latency_percentile(nvehicles, 990), latency_percentile(nvehicles, 999),
+        (unsigned long)(unsigned)atomic_read(&latency_max));
 }
 
 /* 
  * car_approach():
  *
- * Atomically decrements the number of cars from a given lane that have not yet completed their route.
+ * Atomically increments the number of cars from a given lane that have not yet completed their route.
  */
 void car_approach(int lane){
-    struct lock *car_tracker = car_arr_lock;
-    assert(car_tracker!=NULL);
-    lock_acquire(car_tracker);
-    num_cars_waiting[lane]=num_cars_waiting[lane]+1;
-    lock_release(car_tracker);
+    atomic_add(&num_cars_waiting[lane], 1);
+}
+
+/*
+ * car_leave():
+ *
+ * Atomically decrements the number of cars from a given lane that have not yet completed their route.
+ * The last car out of the lane wakes the truck waiting on it (only one truck per lane waits, see approachintersection).
+ */
+void car_leave(int lane){
+
+    //the truck either saw the car (and sleeps on the cv by the time we get car_arr_lock) or sees 0
+    if (atomic_dec_and_test(&num_cars_waiting[lane])){
+        lock_acquire(car_arr_lock);
+        cv_signal(lane_cv[lane], car_arr_lock);
+        lock_release(car_arr_lock);
+    }
 }
 
 /*
  * car_waiting()
  *
+ * Only reads the lane count, so trucks checking different lanes don't block each other.
+ *
  * Returns: false if all cars from the lane have completed their routes, 
  *          true at least 1 car from the lane has yet to complete its route.
  */
 int car_waiting(int lane){
-    struct lock *car_tracker= car_arr_lock;
-    assert(car_tracker!=NULL);
-    lock_acquire(car_tracker);
-
-    if (num_cars_waiting[lane]==0){
-        lock_release(car_tracker);
+    if (atomic_read(&num_cars_waiting[lane])==0){
         return 0;
     }
     else {
-        lock_release(car_tracker);
         return 1;
     }
 }
 
 
+/*
+ * platoon_join()
+ *
+ * Lines a vehicle up behind the leader of its route, if there is one, and waits until
+ * that leader either took it across or handed it the lead.
+ *
+ * Returns: true if the vehicle leads a platoon now, false if it has already crossed.
+ */
+int platoon_join(int lane, int turn, struct platoon_member *self){
+    int spl;
+    struct platoon *route = &platoons[lane][turn];
+
+    lock_acquire(route->lock);
+    if (!route->leading){
+        route->leading = 1;
+        lock_release(route->lock);
+        return 1;
+    }
+
+    //get in line
+    if (route->tail == NULL){
+        route->head = self;
+    }
+    else {
+        route->tail->next = self;
+    }
+    route->tail = self;
+    lock_release(route->lock);
+
+    //the leader sets the flags at splhigh, so checking at splhigh can't miss its wakeup
+    spl = splhigh();
+    while (!self->done && !self->lead){
+        thread_sleep(self);
+    }
+    splx(spl);
+
+    return self->lead;
+}
+
+/*
+ * platoon_fill()
+ *
+ * Called by a leader holding its (first) section: takes up to platoon_size-1 vehicles
+ * waiting on the route along, linked behind the leader.
+ */
+void platoon_fill(int lane, int turn, struct platoon_member *leader){
+    int taken;
+    struct platoon_member *last = leader;
+    struct platoon *route = &platoons[lane][turn];
+
+    if (platoon_size <= 1){
+        return;
+    }
+
+    lock_acquire(route->lock);
+    for (taken = 1; taken < platoon_size && route->head != NULL; taken++){
+        last->next = route->head;
+        last = route->head;
+        route->head = route->head->next;
+    }
+    if (route->head == NULL){
+        route->tail = NULL;
+    }
+    last->next = NULL;
+    lock_release(route->lock);
+}
+
+/*
+ * platoon_done()
+ *
+ * Called by a leader once its platoon is across: lets the followers go and hands the lead
+ * to the oldest vehicle still waiting (it takes the sections again from the back of their
+ * queues, so other routes get their turn in between).
+ */
+void platoon_done(int lane, int turn, struct platoon_member *leader){
+    int spl;
+    struct platoon_member *member, *next;
+    struct platoon_member *successor = NULL;
+    struct platoon *route = &platoons[lane][turn];
+
+    if (platoon_size <= 1){
+        return;
+    }
+
+    lock_acquire(route->lock);
+    if (route->head != NULL){
+        successor = route->head;
+        route->head = successor->next;
+        if (route->head == NULL){
+            route->tail = NULL;
+        }
+    }
+    else {
+        route->leading = 0;
+    }
+    lock_release(route->lock);
+
+    //members are gone as soon as they see their flag, so read next first
+    spl = splhigh();
+    for (member = leader->next; member != NULL; member = next){
+        next = member->next;
+        member->done = 1;
+        thread_wakeup(member);
+    }
+    if (successor != NULL){
+        successor->next = NULL;
+        successor->lead = 1;
+        thread_wakeup(successor);
+    }
+    splx(spl);
+}
+
+/*
+ * phase_demand()
+ *
+ * Caller must hold signal_lock.
+ *
+ * Returns: the number of vehicles waiting for a movement of the phase.
+ */
+int phase_demand(int phase){
+    int move, demand = 0;
+
+    for (move = 0; move < MOVES; move++){
+        if (phase_moves[phase] & (1 << move)){
+            demand += signal_waiting[move];
+        }
+    }
+    return demand;
+}
+
+/*
+ * signal_enter()
+ *
+ * Waits at the gate of the vehicle's movement until a phase with that movement lets it in.
+ */
+void signal_enter(int lane, int turn){
+    int move = MOVE(lane, turn);
+
+    lock_acquire(signal_lock);
+    signal_waiting[move]++;
+
+    //the controller may be idle with nobody waiting
+    cv_signal(controller_cv, signal_lock);
+
+    while (signal_phase < 0 || !(phase_moves[signal_phase] & (1 << move)) || signal_quota == 0){
+        cv_wait(gate_cv[move], signal_lock);
+    }
+
+    signal_waiting[move]--;
+    signal_quota--;
+    signal_inside++;
+
+    //green is used up (or nobody else wants it) -> time to turn red
+    if (signal_quota == 0 || phase_demand(signal_phase) == 0){
+        cv_signal(controller_cv, signal_lock);
+    }
+    lock_release(signal_lock);
+}
+
+/*
+ * signal_leave()
+ *
+ * The vehicle let in by signal_enter is out of the intersection.
+ */
+void signal_leave(void){
+    lock_acquire(signal_lock);
+    signal_inside--;
+
+    //last one out while red -> next phase
+    if (signal_inside == 0 && signal_phase < 0){
+        cv_signal(controller_cv, signal_lock);
+    }
+    lock_release(signal_lock);
+}
+
+/*
+ * signal_controller()
+ *
+ * Controller thread of STRATEGY_SIGNAL: cycles through the phases that have vehicles waiting,
+ * each green for as many vehicles as were waiting (at most PHASE_MAX), then red until they left.
+ * Quits when createvehicles sets signal_stop.
+ */
+static void signal_controller(void *unused, unsigned long phase){
+    int next, move, demand;
+
+    (void) unused;
+
+    lock_acquire(signal_lock);
+    while (!signal_stop){
+
+        //next phase in the cycle that anyone is waiting for
+        for (next = 1; next <= PHASES; next++){
+            if (phase_demand((phase + next) % PHASES) > 0){
+                break;
+            }
+        }
+        if (next > PHASES){
+            cv_wait(controller_cv, signal_lock);
+            continue;
+        }
+        phase = (phase + next) % PHASES;
+
+        //green, as long as the queue was
+        demand = phase_demand(phase);
+        signal_phase = phase;
+        signal_quota = demand < PHASE_MAX ? demand : PHASE_MAX;
+        for (move = 0; move < MOVES; move++){
+            if (phase_moves[phase] & (1 << move)){
+                cv_broadcast(gate_cv[move], signal_lock);
+            }
+        }
+        while (!signal_stop && signal_quota > 0 && phase_demand(phase) > 0){
+            cv_wait(controller_cv, signal_lock);
+        }
+
+        //red until everyone let in is out
+        signal_phase = -1;
+        signal_quota = 0;
+        while (!signal_stop && signal_inside > 0){
+            cv_wait(controller_cv, signal_lock);
+        }
+    }
+    lock_release(signal_lock);
+
+    V(controller_done);
+}
+
 /*
 * Makes a vehicle turn either right or left depending on vehicle direction
 */
 void direction(unsigned long vehicledirection, unsigned long vehiclenumber, unsigned long vehicletype, int turndirection){
+            struct platoon_member self = {vehiclenumber, vehicletype, 0, 0, NULL};
+
+            //wait for a green
+            if (strategy == STRATEGY_SIGNAL){
+                signal_enter(vehicledirection, turndirection);
+            }
+
+            //follow the route's leader across if there is one
+            if (platoon_size > 1 && !platoon_join(vehicledirection, turndirection, &self)){
+                if (strategy == STRATEGY_SIGNAL){
+                    signal_leave();
+                }
+                return;
+            }
+
             if (turndirection==LEFT){
-                turnleft(vehicledirection, vehiclenumber, vehicletype);
+                turnleft(vehicledirection, &self);
             }
             else if (turndirection==RIGHT){
-                turnright(vehicledirection, vehiclenumber, vehicletype);
+                turnright(vehicledirection, &self);
+            }
+
+            platoon_done(vehicledirection, turndirection, &self);
+
+            if (strategy == STRATEGY_SIGNAL){
+                signal_leave();
             }
 }
 
@@ -193,7 +772,8 @@ void direction(unsigned long vehicledirection, unsigned long vehiclenumber, unsi
  * Arguments:
  *      unsigned long vehicledirection: the direction from which the vehicle
  *              approaches the intersection.
- *      unsigned long vehiclenumber: the vehicle id number for printing purposes.
+ *      struct platoon_member *platoon: the vehicle (leading the platoon that
+ *              platoon_fill lines up behind it).
  *
  * Returns:
  *      nothing.
@@ -205,14 +785,14 @@ void direction(unsigned long vehicledirection, unsigned long vehiclenumber, unsi
  */
 
 static void turnleft(unsigned long vehicledirection,
-        unsigned long vehiclenumber,
-        unsigned long vehicletype)
+        struct platoon_member *platoon)
 {
 
+    struct platoon_member *member;
     struct lock *first_lock; 
     struct lock *second_lock;
-    struct lock *duo_lock= left_lock;
-    assert(duo_lock!=NULL);
+    struct semaphore *seats= left_seats;
+    assert(seats!=NULL);
     
     if (vehicledirection==LANEA){
         first_lock=lt_AB;
@@ -227,27 +807,32 @@ static void turnleft(unsigned long vehicledirection,
         assert(second_lock!=NULL);
     }
 
-    else if (vehicledirection==LANEC){
+    else{ //LANEC
+        assert(vehicledirection==LANEC);
         first_lock=lt_CA;
         assert(first_lock!=NULL);
         second_lock=lt_AB;
         assert(second_lock!=NULL);
     }
     
-    lock_acquire(duo_lock); //This will make sure this thread will turn left.
+    P(seats); //Left turns from other lanes go on unless all the seats are taken (no circular wait).
     lock_acquire(first_lock); //This will make sure this thread will have the first lock.
+    platoon_fill(vehicledirection, LEFT, platoon); //Bring along whoever queued up behind us meanwhile.
 
-        print_info(vehicletype, vehiclenumber, vehicledirection, LEFT, first_lock->name, ENT);//Enter space 1 
-        print_info(vehicletype, vehiclenumber, vehicledirection, LEFT, first_lock->name, EXT);//Exit space 1
+        for (member = platoon; member != NULL; member = member->next){
+            log_event(member->type, member->number, vehicledirection, LEFT, first_lock, ENT);//Enter the first section
+            log_event(member->type, member->number, vehicledirection, LEFT, first_lock, EXT);//Leave the first section
+        }
         lock_acquire(second_lock); //Try to grab the second lock
    
-        lock_release(duo_lock);
+        V(seats);
         lock_release(first_lock);
-        print_info(vehicletype, vehiclenumber, vehicledirection, LEFT, second_lock->name, ENT);//Exit space 1
-        print_info(vehicletype, vehiclenumber, vehicledirection, LEFT, second_lock->name, EXT);//Exit space 1
+        for (member = platoon; member != NULL; member = member->next){
+            log_event(member->type, member->number, vehicledirection, LEFT, second_lock, ENT);//Enter the second section
+            log_event(member->type, member->number, vehicledirection, LEFT, second_lock, EXT);//Leave the second section
+        }
 
 
-    remove_vehicle(); //Decrement the total number of car
     lock_release(second_lock);
 }
 
@@ -258,7 +843,8 @@ static void turnleft(unsigned long vehicledirection,
  * Arguments:
  *      unsigned long vehicledirection: the direction from which the vehicle
  *              approaches the intersection.
- *      unsigned long vehiclenumber: the vehicle id number for printing purposes.
+ *      struct platoon_member *platoon: the vehicle (leading the platoon that
+ *              platoon_fill lines up behind it).
  *
  * Returns:
  *      nothing.
@@ -270,9 +856,9 @@ static void turnleft(unsigned long vehicledirection,
  */
 
 static void turnright(unsigned long vehicledirection,
-        unsigned long vehiclenumber,
-        unsigned long vehicletype)
+        struct platoon_member *platoon)
 {
+    struct platoon_member *member;
     struct lock *rLock; //lock for the right turn
 
     if (vehicledirection==LANEA){
@@ -281,21 +867,20 @@ static void turnright(unsigned long vehicledirection,
     else if (vehicledirection==LANEB){	
         rLock=lt_BC;
     }
-    else if (vehicledirection==LANEC){
+    else{ //LANEC
+        assert(vehicledirection==LANEC);
         rLock=lt_CA;
     }
     assert(rLock != NULL);
     lock_acquire(rLock);
+    platoon_fill(vehicledirection, RIGHT, platoon); //Bring along whoever queued up behind us meanwhile.
 
-    //if vehicle has the lock it needs to turn
-    if(lock_do_i_hold(rLock)){
-
-        //display info for entering/exiting
-        print_info(vehicletype, vehiclenumber, vehicledirection, RIGHT, rLock->name, ENT);
-        print_info(vehicletype, vehiclenumber, vehicledirection, RIGHT, rLock->name, EXT);
-        remove_vehicle(); //Decrement the total number of car in the lane.
-        lock_release(rLock);
+    //display info for entering/exiting
+    for (member = platoon; member != NULL; member = member->next){
+        log_event(member->type, member->number, vehicledirection, RIGHT, rLock, ENT);
+        log_event(member->type, member->number, vehicledirection, RIGHT, rLock, EXT);
     }
+    lock_release(rLock);
 }
 
 
@@ -325,20 +910,17 @@ static void turnright(unsigned long vehicledirection,
         {
             (void) vehicle;
             int vehicledirection, turndirection, vehicletype;
-            int spl;
+            u_int64_t start = now_ns(); //for the latency report
             struct lock *truck_lock; //Lock to make sure no more truck cut infront of the first waiting truck
             struct lock *arr_car_lock=car_arr_lock;
             assert(arr_car_lock!=NULL);
-
-            struct lock *vehicle_lock= total_car_lock;
-            assert(vehicle_lock!=NULL);
             
             /*
              * vehicledirection is set randomly.
              */
-            vehicledirection = random() % 3; //Which lanes the vehicle is in
+            vehicledirection = choose_lane(); //Which lanes the vehicle is in
             turndirection = random() % 2; //Turning direction / left or right
-            vehicletype = random() % 2; //Truck or Car
+            vehicletype = (int)(random() % 100) < truck_percent ? TRUCK : CAR; //Truck or Car
 
              if (vehicledirection==LANEA){
                     truck_lock=truck_lock_A;
@@ -346,55 +928,38 @@ static void turnright(unsigned long vehicledirection,
                 else if (vehicledirection==LANEB){
                     truck_lock=truck_lock_B;
                 }
-                else if (vehicledirection==LANEC){
+                else{ //LANEC
+                    assert(vehicledirection==LANEC);
                     truck_lock=truck_lock_C;
                 }
 
             assert(truck_lock!=NULL);
 
             //tell the world that you're approaching the intersection 
-            print_info(vehicletype, vehiclenumber, vehicledirection, turndirection, NULL, APR);
+            log_event(vehicletype, vehiclenumber, vehicledirection, turndirection, NULL, APR);
             
             //if car, update number of cars waiting for lane
             if(vehicletype == CAR){
-                spl=splhigh();
-                car_approach(vehicledirection); //update the lane count up, this will have the lock inside based on the lane:           
-                splx(spl);
-                /*
-                 * Inside the function:
-                 * lock array -> car count on the lane ++ -> unlock array
-                 */
+                car_approach(vehicledirection); //update the lane count up (atomic add, no lock)
                 
                 direction(vehicledirection, vehiclenumber, vehicletype, turndirection); 
 
                 //update array atomically
-               lock_acquire(arr_car_lock);
-               num_cars_waiting[vehicledirection]--;
-               lock_release(arr_car_lock);
-
-                //wake up sleeping truck if there are no cars in lane (sleep address is num_cars_waiting)
-
-             spl=splhigh();
-                if (car_waiting(vehicledirection)==0){
-                    if (thread_hassleepers(&num_cars_waiting[vehicledirection])!=0){
-                        thread_wakeup(&num_cars_waiting[vehicledirection]);                     
-                    }
-
-                }
-
-                splx(spl);
+                car_leave(vehicledirection);
           }
           else if (vehicletype==TRUCK){
           
                 //get truck lock               
                 lock_acquire(truck_lock);
 
-                //sleep if there are cars waiting
-                spl=splhigh();
+                //wait while there are cars in the lane (truck_lock keeps the other trucks of the lane out of the cv)
                 if(car_waiting(vehicledirection)==1){
-                    thread_sleep(&num_cars_waiting[vehicledirection]);
+                    lock_acquire(arr_car_lock);
+                    while(car_waiting(vehicledirection)==1){
+                        cv_wait(lane_cv[vehicledirection], arr_car_lock);
+                    }
+                    lock_release(arr_car_lock);
                 }
-                splx(spl);
 
                 if (lock_do_i_hold(truck_lock)){
                    lock_release(truck_lock);
@@ -405,18 +970,10 @@ static void turnright(unsigned long vehicledirection,
           }
                
              
-          //wake up mama thread if we are last vehicle
-          spl=splhigh();
-          if(vehicles_remaining==0){
-           // lock_release(vehicle_lock);
-            if (thread_hassleepers(&mom)!=0){
-            thread_wakeup(&mom);
-            }
-            else {
-                panic("Where is mom :( ?\n");
-            }
-          }
-          splx(spl);
+          record_latency(start);
+
+          //done (the last vehicle wakes createvehicles)
+          latch_count_down(vehicles_left);
         
 
         }
@@ -426,11 +983,15 @@ static void turnright(unsigned long vehicledirection,
      * createvehicles()
      *
      * Arguments:
-     *      int nargs: unused.
-     *      char ** args: unused.
+     *      int nargs: number of args.
+     *      char ** args: command name, then optionally the number of vehicles, the percentage of
+     *              trucks, the relative traffic of lanes A, B and C, the most vehicles of a
+     *              route crossing together and the strategy, "locks" or "signal" (defaults:
+     *              20, 50, 1 1 1, 1, locks).
      *
      * Returns:
-     *      0 on success.
+     *      0 on success, EINVAL for bad arguments, ENOMEM if the intersection couldn't be set
+     *      up (everything made before the failure is destroyed again).
      *
      * Notes:
      *      Driver code to start up the approachintersection() threads.  You are
@@ -440,106 +1001,188 @@ static void turnright(unsigned long vehicledirection,
     int createvehicles(int nargs, char ** args){
 
 
-        int index, error;
+        unsigned long index;
+        int error, turn;
+        u_int64_t start, elapsed;
+        static const char *platoon_names[3][2] = {
+            {"Platoon A right", "Platoon A left"},
+            {"Platoon B right", "Platoon B left"},
+            {"Platoon C right", "Platoon C left"},
+        };
+        static const char *gate_names[MOVES] = {
+            "Gate A right", "Gate A left", "Gate B right", "Gate B left", "Gate C right", "Gate C left",
+        };
 
         /*
-         * Avoid unused variable warnings.
+         * Run settings from the command line.
          */
 
-        (void) nargs;
-        (void) args;
-
-        //bunch of locks
-        struct lock *lockAB, *lockBC, *lockCA;
-        
-        struct lock *left;
-
-        struct lock *truckA, *truckB, *truckC;
-
-        struct lock *arr_lock;
+        nvehicles = nargs > 1 ? (unsigned long)atoi(args[1]) : NVEHICLES;
+        truck_percent = nargs > 2 ? atoi(args[2]) : TRUCK_PERCENT;
+        for (index = 0; index < 3; index++){
+            lane_weight[index] = nargs > 5 ? atoi(args[3 + index]) : 1;
+        }
+        platoon_size = nargs > 6 ? atoi(args[6]) : PLATOON_SIZE;
+        strategy = nargs > 7 && strcmp(args[7], "signal") == 0 ? STRATEGY_SIGNAL : STRATEGY_LOCKS;
+
+        if (nvehicles == 0 || nvehicles > 0x7fffffff || truck_percent < 0 || truck_percent > 100 ||
+            lane_weight[LANEA] < 0 || lane_weight[LANEB] < 0 || lane_weight[LANEC] < 0 ||
+            lane_weight[LANEA] + lane_weight[LANEB] + lane_weight[LANEC] <= 0 || platoon_size < 1 ||
+            (nargs > 7 && strategy == STRATEGY_LOCKS && strcmp(args[7], "locks") != 0)){
+            kprintf("usage: %s [vehicles [truck%%] [laneA laneB laneC [platoon [locks|signal]]]]\n", nargs > 0 ? args[0] : "sp");
+            return EINVAL;
+        }
 
-        struct lock *veh_lock;
+        //contention numbers for this run only (see synch_prof_dump at the end)
+        synch_prof_reset();
+
+        //nothing made yet: the clean up at the end destroys whatever isn't NULL, so any failure
+        //can jump there
+        lt_AB= lt_BC= lt_CA= NULL;
+        left_seats= NULL;
+        truck_lock_A= truck_lock_B= truck_lock_C= NULL;
+        car_arr_lock= NULL;
+        lane_cv[LANEA]= lane_cv[LANEB]= lane_cv[LANEC]= NULL;
+        for (index = 0; index < 3; index++) {
+            platoons[index][RIGHT].lock= platoons[index][LEFT].lock= NULL;
+        }
+        signal_lock= NULL;
+        controller_cv= NULL;
+        controller_done= NULL;
+        for (index = 0; index < MOVES; index++) {
+            gate_cv[index]= NULL;
+        }
+        event_log= NULL;
+        event_count= NULL;
+        vehicles_left= NULL;
+        error= ENOMEM;
 
         /*
          * Initialize the intersection lock:
          */
-        lockAB = lock_create("AB");
-        if (lockAB == NULL) {	
-            return ENOMEM;
-        }
-        lockBC = lock_create("BC");
-        if (lockBC == NULL) {
-            lock_destroy(lockAB);
-            return ENOMEM;
+        lt_AB= lock_create("AB");
+        lt_BC= lock_create("BC");
+        lt_CA= lock_create("CA");
+        if (lt_AB==NULL || lt_BC==NULL || lt_CA==NULL){
+            goto cleanup;
         }
 
-        lockCA = lock_create("CA");	
-        if (lockCA == NULL) {
-            lock_destroy(lockBC);
-            lock_destroy(lockAB);
-            return ENOMEM;
-        }
-
-        //set global lock
-        lt_AB=lockAB;
-        lt_BC=lockBC;
-        lt_CA=lockCA;
+        //sections are only held for a move, spin a little before sleeping on them
+        lock_set_adaptive(lt_AB, 1);
+        lock_set_adaptive(lt_BC, 1);
+        lock_set_adaptive(lt_CA, 1);
         
-        left=lock_create("Left lock");
-        if (left==NULL){
-            return ENOMEM;
+        left_seats=sem_create("Left turn seats", LEFT_SEATS);
+        if (left_seats==NULL){
+            goto cleanup;
         }
-        left_lock=left;
 
         /*
          *
          * Creating lane lock:
          */
-        truckA=lock_create("Lane A truck");
-        if(truckA==NULL){
-            return ENOMEM;
+        truck_lock_A= lock_create("Lane A truck");
+        truck_lock_B= lock_create("Lane B truck");
+        truck_lock_C= lock_create("Lane C truck");
+        if (truck_lock_A==NULL || truck_lock_B==NULL || truck_lock_C==NULL){
+            goto cleanup;
         }
-        truckB=lock_create("Lane B truck");
-        if (truckB==NULL){
-            lock_destroy(truckA);
-            return ENOMEM;
+
+        /*
+         * Car tracker: lock for the lane cvs (the counts themselves are atomic):
+         */
+
+        car_arr_lock= lock_create("Koons");
+        if (car_arr_lock ==NULL){
+            goto cleanup;
         }
-        truckC=lock_create("Lane C truck");
-        if (truckC==NULL){
-            lock_destroy(truckA);
-            lock_destroy(truckB);
-            return ENOMEM;
+
+        //only held for a check and a signal
+        lock_set_adaptive(car_arr_lock, 1);
+
+        /*
+         * Lane cvs the trucks wait on:
+         */
+        lane_cv[LANEA]= cv_create("Lane A cars");
+        lane_cv[LANEB]= cv_create("Lane B cars");
+        lane_cv[LANEC]= cv_create("Lane C cars");
+        if (lane_cv[LANEA]==NULL || lane_cv[LANEB]==NULL || lane_cv[LANEC]==NULL){
+            goto cleanup;
         }
 
-        //Link the lane lock with global lock:
-        truck_lock_A= truckA;
-        truck_lock_B= truckB;
-        truck_lock_C= truckC;
+        /*
+         * Platoon queue of every route:
+         */
+        for (index = 0; index < 3; index++) {
+            for (turn = RIGHT; turn <= LEFT; turn++) {
+                platoons[index][turn].lock= lock_create(platoon_names[index][turn]);
+                if (platoons[index][turn].lock==NULL){
+                    goto cleanup;
+                }
+                platoons[index][turn].leading= 0;
+                platoons[index][turn].head= NULL;
+                platoons[index][turn].tail= NULL;
+            }
+        }
 
         /*
-         * Car tracker: Array lock:
+         * Event log, empty:
          */
+        event_log= kmalloc(nvehicles * EVENTS_PER_VEHICLE * sizeof(struct vehicle_event));
+        event_count= kmalloc(nvehicles * sizeof(u_int8_t));
+        if (event_log==NULL || event_count==NULL){
+            goto cleanup;
+        }
+        for (index = 0; index < nvehicles; index++) {
+            event_count[index]= 0;
+        }
+        atomic_set(&event_seq, 0);
 
-        veh_lock= lock_create("Seven Corner");
-        if (veh_lock ==NULL){
-            return ENOMEM;
+        vehicles_left= latch_create("Vehicles left", (int)nvehicles);
+        if (vehicles_left==NULL){
+            goto cleanup;
         }
-        total_car_lock= veh_lock;
 
+        /*
+         * Traffic signal, with its controller running before the first vehicle shows up (made
+         * last, so a failure never has a controller to stop):
+         */
+        if (strategy == STRATEGY_SIGNAL){
+            signal_lock= lock_create("Signal");
+            controller_cv= cv_create("Signal controller");
+            controller_done= sem_create("Signal controller done", 0);
+            if (signal_lock==NULL || controller_cv==NULL || controller_done==NULL){
+                goto cleanup;
+            }
+            for (index = 0; index < MOVES; index++) {
+                gate_cv[index]= cv_create(gate_names[index]);
+                if (gate_cv[index]==NULL){
+                    goto cleanup;
+                }
+                signal_waiting[index]= 0;
+            }
+            signal_phase= -1;
+            signal_quota= 0;
+            signal_inside= 0;
+            signal_stop= 0;
 
-        arr_lock= lock_create("Koons");
-        if (arr_lock ==NULL){
-            return ENOMEM;
+            error = thread_fork("signal controller thread", NULL, PHASES - 1, signal_controller, NULL);
+            if (error) {
+                panic("signal_controller: thread_fork failed: %s\n", strerror(error));
+            }
         }
-        car_arr_lock= arr_lock;
 
-       
-        vehicles_remaining=NVEHICLES;
+        //fresh latency numbers for this run
+        for (index = 0; index < LAT_BUCKETS; index++) {
+            atomic_set(&latency_hist[index], 0);
+        }
+        atomic_set(&latency_max, 0);
+        start = now_ns();
 
         /*
-         * Start NVEHICLES approachintersection() threads.
+         * Start nvehicles approachintersection() threads.
          */
-        for (index = 0; index < NVEHICLES; index++) {
+        for (index = 0; index < nvehicles; index++) {
 
             error = thread_fork("approachintersection thread",
                     NULL,
@@ -560,30 +1203,112 @@ static void turnright(unsigned long vehicledirection,
 
         }
 
-        int spl;
-        spl=splhigh();
-        if (vehicles_remaining != 0){
-            thread_sleep(&mom);
-           splx(spl);
+        //sleep until the last vehicle is done (it may well be done already)
+        latch_wait(vehicles_left);
 
+        //how long it took, before the log is printed
+        elapsed = now_ns() - start;
+
+        //switch the signal off and wait for the controller to notice (the clean up destroys it)
+        if (strategy == STRATEGY_SIGNAL){
+            lock_acquire(signal_lock);
+            assert(signal_inside==0);
+            signal_stop= 1;
+            cv_signal(controller_cv, signal_lock);
+            lock_release(signal_lock);
+            P(controller_done);
         }
-        else{
-            splx(spl);
-        }
+
+        //what happened, then how fast
+        flush_events();
+        report_run(elapsed);
+
+        //which locks the vehicles fought over (SYNCH_PROFILE builds)
+        synch_prof_dump();
+
         //Factory Reset:
-        vehicles_remaining = NVEHICLES;
-        num_cars_waiting[0]=0;
-        num_cars_waiting[1]=0;
-        num_cars_waiting[2]=0;
-        //Clean up after done:
-        lock_destroy(lt_AB);
-        lock_destroy(lt_BC);
-        lock_destroy(lt_CA);
-        lock_destroy(left_lock);
-        lock_destroy(truck_lock_A);
-        lock_destroy(truck_lock_B);
-        lock_destroy(truck_lock_C);
-        lock_destroy(total_car_lock);
-        lock_destroy(car_arr_lock);
-        return 0;
+        atomic_set(&num_cars_waiting[0], 0);
+        atomic_set(&num_cars_waiting[1], 0);
+        atomic_set(&num_cars_waiting[2], 0);
+
+    cleanup:
+        //Clean up after done, or after whatever got made before a failure:
+        if (vehicles_left != NULL){
+            latch_destroy(vehicles_left);
+            vehicles_left= NULL;
+        }
+        if (signal_lock != NULL){
+            lock_destroy(signal_lock);
+            signal_lock= NULL;
+        }
+        if (controller_cv != NULL){
+            cv_destroy(controller_cv);
+            controller_cv= NULL;
+        }
+        if (controller_done != NULL){
+            sem_destroy(controller_done);
+            controller_done= NULL;
+        }
+        for (index = 0; index < MOVES; index++) {
+            if (gate_cv[index] != NULL){
+                cv_destroy(gate_cv[index]);
+                gate_cv[index]= NULL;
+            }
+        }
+        if (event_log != NULL){
+            kfree(event_log);
+            event_log= NULL;
+        }
+        if (event_count != NULL){
+            kfree(event_count);
+            event_count= NULL;
+        }
+        for (index = 0; index < 3; index++) {
+            for (turn = RIGHT; turn <= LEFT; turn++) {
+                if (platoons[index][turn].lock != NULL){
+                    assert(platoons[index][turn].head==NULL && !platoons[index][turn].leading);
+                    lock_destroy(platoons[index][turn].lock);
+                    platoons[index][turn].lock= NULL;
+                }
+            }
+        }
+        for (index = 0; index < 3; index++) {
+            if (lane_cv[index] != NULL){
+                cv_destroy(lane_cv[index]);
+                lane_cv[index]= NULL;
+            }
+        }
+        if (car_arr_lock != NULL){
+            lock_destroy(car_arr_lock);
+            car_arr_lock= NULL;
+        }
+        if (truck_lock_A != NULL){
+            lock_destroy(truck_lock_A);
+            truck_lock_A= NULL;
+        }
+        if (truck_lock_B != NULL){
+            lock_destroy(truck_lock_B);
+            truck_lock_B= NULL;
+        }
+        if (truck_lock_C != NULL){
+            lock_destroy(truck_lock_C);
+            truck_lock_C= NULL;
+        }
+        if (left_seats != NULL){
+            sem_destroy(left_seats);
+            left_seats= NULL;
+        }
+        if (lt_AB != NULL){
+            lock_destroy(lt_AB);
+            lt_AB= NULL;
+        }
+        if (lt_BC != NULL){
+            lock_destroy(lt_BC);
+            lt_BC= NULL;
+        }
+        if (lt_CA != NULL){
+            lock_destroy(lt_CA);
+            lt_CA= NULL;
+        }
+        return error;
     }
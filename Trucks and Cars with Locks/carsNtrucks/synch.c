@@ -9,10 +9,422 @@
 #include <thread.h>
 #include <curthread.h>
 #include <machine/spl.h>
+#ifdef SYNCH_PROFILE
+#include <clock.h>
+#endif
 
 #define HELD 1
 #define FREE 0
 
+/*
+ * Adaptive locks spin at most min(LOCK_SPIN_MAX, 2 * average + LOCK_SPIN_MIN)
+ * times before sleeping.
+ */
+#define LOCK_SPIN_MIN 10
+#define LOCK_SPIN_MAX 100
+
+////////////////////////////////////////////////////////////
+//
+// Wait queue (all of these must be called at splhigh).
+
+static
+void
+waitq_init(struct synch_waitq *wq)
+{
+	wq->head = NULL;
+	wq->tail = NULL;
+	wq->count = 0;
+}
+
+/*
+ * Put the current thread at the back of the queue. It isn't asleep
+ * until it calls waitq_sleep on the same node.
+ */
+static
+void
+waitq_enqueue(struct synch_waitq *wq, struct synch_waiter *self)
+{
+	self->thread = curthread;
+	self->woken = 0;
+	self->next = NULL;
+
+	if (wq->tail == NULL) {
+		wq->head = self;
+	}
+	else {
+		wq->tail->next = self;
+	}
+	wq->tail = self;
+	wq->count++;
+}
+
+static
+void
+waitq_sleep(struct synch_waiter *self)
+{
+	while (!self->woken) {
+		thread_sleep(self);
+	}
+}
+
+/*
+ * Wake the thread at the front of the queue, if any.
+ * Returns the thread woken, NULL if the queue was empty.
+ */
+static
+struct thread *
+waitq_wake_one(struct synch_waitq *wq)
+{
+	struct synch_waiter *first = wq->head;
+
+	if (first == NULL) {
+		return NULL;
+	}
+
+	wq->head = first->next;
+	if (wq->head == NULL) {
+		wq->tail = NULL;
+	}
+	wq->count--;
+
+	first->woken = 1;
+	thread_wakeup(first);
+	return first->thread;
+}
+
+
+////////////////////////////////////////////////////////////
+//
+// Contention profiling (counters are only touched at splhigh).
+
+#define PROF_LOCK 0
+#define PROF_SEM  1
+
+/*
+ * Most distinct names profiled at once, and number of hold time
+ * buckets: bucket 0 is under 1us, bucket i (i > 0) is under 2^i us and
+ * the last one also gets everything longer.
+ */
+#define PROF_ENTRIES 64
+#define PROF_BUCKETS 16
+
+struct synch_prof {
+	char *name;
+	int kind;                       /* PROF_LOCK or PROF_SEM */
+	u_int32_t acquisitions;
+	u_int32_t contended;            /* had to spin or sleep first */
+	u_int64_t wait_total;           /* ns */
+	u_int64_t wait_max;             /* ns */
+	u_int32_t released;             /* lock_release or V calls */
+	u_int32_t handoffs;             /* releases that passed it to a waiter */
+	u_int64_t hold_total;           /* ns, locks only */
+	u_int32_t hold[PROF_BUCKETS];   /* hold time histogram, locks only */
+};
+
+#ifdef SYNCH_PROFILE
+
+static struct synch_prof prof_table[PROF_ENTRIES];
+static int prof_count;
+
+static
+u_int64_t
+prof_now(void)
+{
+	time_t secs;
+	u_int32_t nsecs;
+
+	gettime(&secs, &nsecs);
+	return (u_int64_t)secs * 1000000000 + nsecs;
+}
+
+/*
+ * Find the counters for a primitive, adding them the first time the
+ * name shows up. Returns NULL (not profiled) when the table is full.
+ */
+static
+struct synch_prof *
+prof_lookup(const char *name, int kind)
+{
+	struct synch_prof *prof = NULL;
+	int i, spl;
+
+	spl = splhigh();
+
+	for (i = 0; i < prof_count; i++) {
+		if (prof_table[i].kind == kind &&
+		    strcmp(prof_table[i].name, name) == 0) {
+			prof = &prof_table[i];
+			break;
+		}
+	}
+
+	if (prof == NULL && prof_count < PROF_ENTRIES) {
+		prof_table[prof_count].name = kstrdup(name);
+		if (prof_table[prof_count].name != NULL) {
+			prof = &prof_table[prof_count];
+			prof->kind = kind;
+			prof_count++;
+		}
+	}
+
+	splx(spl);
+	return prof;
+}
+
+/*
+ * Count an acquisition that started waiting at start.
+ * Returns the time it was acquired (when the hold starts).
+ */
+static
+u_int64_t
+prof_acquired(struct synch_prof *prof, u_int64_t start, int contended)
+{
+	u_int64_t now = prof_now();
+	u_int64_t wait = now - start;
+
+	if (prof != NULL) {
+		prof->acquisitions++;
+		prof->contended += contended;
+		prof->wait_total += wait;
+		if (wait > prof->wait_max) {
+			prof->wait_max = wait;
+		}
+	}
+
+	return now;
+}
+
+static
+void
+prof_released(struct synch_prof *prof, u_int64_t start)
+{
+	u_int64_t hold = prof_now() - start;
+	u_int64_t us = hold / 1000;
+	int bucket = 0;
+
+	if (prof == NULL) {
+		return;
+	}
+
+	while (us > 0 && bucket < PROF_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+
+	prof->hold_total += hold;
+	prof->hold[bucket]++;
+}
+
+/*
+ * Count a lock_release or V, handoff set when it went to a sleeper.
+ */
+static
+void
+prof_signaled(struct synch_prof *prof, int handoff)
+{
+	if (prof != NULL) {
+		prof->released++;
+		prof->handoffs += handoff;
+	}
+}
+
+#else
+
+// not profiling: nothing to look up or count
+
+#define prof_now() 0
+#define prof_lookup(name, kind) NULL
+
+static
+u_int64_t
+prof_acquired(struct synch_prof *prof, u_int64_t start, int contended)
+{
+	(void)prof;
+	(void)start;
+	(void)contended;
+	return 0;
+}
+
+static
+void
+prof_released(struct synch_prof *prof, u_int64_t start)
+{
+	(void)prof;
+	(void)start;
+}
+
+static
+void
+prof_signaled(struct synch_prof *prof, int handoff)
+{
+	(void)prof;
+	(void)handoff;
+}
+
+#endif /* SYNCH_PROFILE */
+
+void
+synch_prof_reset(void)
+{
+#ifdef SYNCH_PROFILE
+	int i, j, spl;
+
+	spl = splhigh();
+	for (i = 0; i < prof_count; i++) {
+		prof_table[i].acquisitions = 0;
+		prof_table[i].contended = 0;
+		prof_table[i].wait_total = 0;
+		prof_table[i].wait_max = 0;
+		prof_table[i].released = 0;
+		prof_table[i].handoffs = 0;
+		prof_table[i].hold_total = 0;
+		for (j = 0; j < PROF_BUCKETS; j++) {
+			prof_table[i].hold[j] = 0;
+		}
+	}
+	splx(spl);
+#endif
+}
+
+void
+synch_prof_dump(void)
+{
+#ifdef SYNCH_PROFILE
+	int order[PROF_ENTRIES];
+	int count, i, j, spl;
+
+	// rank by total wait time (insertion sort, there are few of them)
+	spl = splhigh();
+	count = prof_count;
+	for (i = 0; i < count; i++) {
+		for (j = i; j > 0 &&
+		     prof_table[order[j-1]].wait_total < prof_table[i].wait_total; j--) {
+			order[j] = order[j-1];
+		}
+		order[j] = i;
+	}
+	splx(spl);
+
+	kprintf("%-20s %4s %8s %8s %5s %12s %10s %8s %8s %10s\n", "name", "kind",
+		"acquired", "waited", "%", "wait us", "max us", "released",
+		"handoffs", "avg hold us");
+
+	for (i = 0; i < count; i++) {
+		struct synch_prof *prof = &prof_table[order[i]];
+
+		// a semaphore may only ever be V'd here (its P's are elsewhere)
+		if (prof->acquisitions == 0 && prof->released == 0) {
+			continue;
+		}
+
+		kprintf("%-20s %4s %8lu %8lu %5lu %12llu %10llu %8lu %8lu ",
+			prof->name, prof->kind == PROF_LOCK ? "lock" : "sem",
+			(unsigned long)prof->acquisitions,
+			(unsigned long)prof->contended,
+			(unsigned long)(prof->acquisitions == 0 ? 0 :
+				prof->contended * 100ULL / prof->acquisitions),
+			(unsigned long long)(prof->wait_total / 1000),
+			(unsigned long long)(prof->wait_max / 1000),
+			(unsigned long)prof->released,
+			(unsigned long)prof->handoffs);
+
+		if (prof->kind != PROF_LOCK) {
+			kprintf("%10s\n", "-");
+			continue;
+		}
+
+		kprintf("%10llu\n", prof->acquisitions == 0 ? 0ULL :
+			(unsigned long long)(prof->hold_total / 1000 / prof->acquisitions));
+
+		// hold time histogram, empty buckets left out
+		kprintf("    hold:");
+		for (j = 0; j < PROF_BUCKETS; j++) {
+			if (prof->hold[j] == 0) {
+				continue;
+			}
+			if (j == PROF_BUCKETS - 1) {
+				kprintf(" >=%luus:%lu", 1UL << (j - 1),
+					(unsigned long)prof->hold[j]);
+			}
+			else {
+				kprintf(" <%luus:%lu", 1UL << j,
+					(unsigned long)prof->hold[j]);
+			}
+		}
+		kprintf("\n");
+	}
+#endif
+}
+
+
+////////////////////////////////////////////////////////////
+//
+// Atomic integer.
+
+int
+atomic_read(struct atomic *a)
+{
+#ifdef SYNCH_HAVE_ATOMICS
+	return __atomic_load_n(&a->value, __ATOMIC_SEQ_CST);
+#else
+	// a single aligned load can't be torn on a uniprocessor
+	return a->value;
+#endif
+}
+
+void
+atomic_set(struct atomic *a, int value)
+{
+#ifdef SYNCH_HAVE_ATOMICS
+	__atomic_store_n(&a->value, value, __ATOMIC_SEQ_CST);
+#else
+	a->value = value;
+#endif
+}
+
+int
+atomic_add(struct atomic *a, int delta)
+{
+#ifdef SYNCH_HAVE_ATOMICS
+	return __atomic_fetch_add(&a->value, delta, __ATOMIC_SEQ_CST);
+#else
+	int spl, old;
+
+	spl = splhigh();
+	old = a->value;
+	a->value = old + delta;
+	splx(spl);
+
+	return old;
+#endif
+}
+
+int
+atomic_cas(struct atomic *a, int old, int new)
+{
+#ifdef SYNCH_HAVE_ATOMICS
+	return __atomic_compare_exchange_n(&a->value, &old, new, 0,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#else
+	int spl, swapped = 0;
+
+	spl = splhigh();
+	if (a->value == old) {
+		a->value = new;
+		swapped = 1;
+	}
+	splx(spl);
+
+	return swapped;
+#endif
+}
+
+int
+atomic_dec_and_test(struct atomic *a)
+{
+	return atomic_add(a, -1) == 1;
+}
+
 
 ////////////////////////////////////////////////////////////
 //
@@ -37,6 +449,7 @@ sem_create(const char *namearg, int initial_count)
 	}
 
 	sem->count = initial_count;
+	sem->prof = prof_lookup(namearg, PROF_SEM);
 	return sem;
 }
 
@@ -66,7 +479,8 @@ sem_destroy(struct semaphore *sem)
 void 
 P(struct semaphore *sem)
 {
-	int spl;
+	int spl, contended;
+	u_int64_t start = prof_now();
 	assert(sem != NULL);
 
 	/*
@@ -78,11 +492,13 @@ P(struct semaphore *sem)
 	assert(in_interrupt==0);
 
 	spl = splhigh();
+	contended = sem->count==0;
 	while (sem->count==0) {
 		thread_sleep(sem);
 	}
 	assert(sem->count>0);
 	sem->count--;
+	prof_acquired(sem->prof, start, contended);
 	splx(spl);
 }
 
@@ -94,6 +510,7 @@ V(struct semaphore *sem)
 	spl = splhigh();
 	sem->count++;
 	assert(sem->count>0);
+	prof_signaled(sem->prof, thread_hassleepers(sem));
 	thread_wakeup(sem);
 	splx(spl);
 }
@@ -121,6 +538,11 @@ lock_create(const char *name)
 	// intialize lock to be unlocked and have no holder
     lock->status = FREE;
     lock->holder = NULL;
+    waitq_init(&lock->waiters);
+    lock->adaptive = 0;
+    lock->spin_budget = 0;
+    lock->prof = prof_lookup(name, PROF_LOCK);
+    lock->hold_start = 0;
 
 	return lock;
 }
@@ -134,7 +556,7 @@ lock_destroy(struct lock *lock)
 
     //make sure no threads are waiting to acquire the lock
 	spl = splhigh();
-	assert(thread_hassleepers(lock)==0);
+	assert(lock->waiters.count==0);
 	
     //Check if any thread holding the lock:
 	assert(lock->status==FREE);
@@ -149,19 +571,78 @@ void
 lock_acquire(struct lock *lock)
 {
     int spl;
+    int contended = 0;
+    u_int64_t start = prof_now();
+    struct synch_waiter self;
     assert(lock!= NULL);
     assert(in_interrupt == 0);
+
+    //adaptive lock: spin while the holder is still running and nobody is in line
+    if(lock->adaptive){
+
+        int spins = 0;
+        int average;
+        int max_spins;
+
+        spl = splhigh();
+        average = lock->spin_budget / 8;
+        splx(spl);
+
+        max_spins = 2 * average + LOCK_SPIN_MIN;
+
+        if(max_spins > LOCK_SPIN_MAX){
+            max_spins = LOCK_SPIN_MAX;
+        }
+
+        while(1){
+
+            spl = splhigh();
+
+            //free -> take it without ever sleeping
+            if(lock->status == FREE){
+                lock->status = HELD;
+                lock->holder = curthread;
+                lock->spin_budget += spins - average;
+                lock->hold_start = prof_acquired(lock->prof, start, contended);
+                splx(spl);
+                return;
+            }
+            contended = 1;
+
+            //holder asleep (won't let go soon), others queued (don't cut in line) or out of spins
+            if(spins >= max_spins || lock->waiters.count > 0 ||
+                (lock->holder != NULL && lock->holder->t_sleepaddr != NULL)){
+                lock->spin_budget += spins - average;
+                splx(spl);
+                break;
+            }
+            splx(spl);
+
+            //uniprocessor: the holder only gets to finish if we let it run
+            spins++;
+            thread_yield();
+        }
+    }
+
     spl = splhigh();
     
-    //sleep while another thread holds this lock
-    while(lock->status == HELD){
-        thread_sleep(lock); //Sleep on the address of the lock
+    //another thread holds this lock -> get in line, lock_release hands it over when it's our turn
+    if(lock->status == HELD){
+        waitq_enqueue(&lock->waiters, &self);
+        waitq_sleep(&self);
+        assert(lock->holder == curthread);
+
+        //the hold started at the handoff (lock_release stamped it), waking up is part of it
+        prof_acquired(lock->prof, start, 1);
     }
 
     //grab lock once no thread is holding it
-    assert(lock->status == FREE); //Double check if the status is free before take the lock
-    lock->status = HELD;
-    lock->holder = curthread;
+    else{
+        assert(lock->status == FREE); //Double check if the status is free before take the lock
+        lock->status = HELD;
+        lock->holder = curthread;
+        lock->hold_start = prof_acquired(lock->prof, start, contended);
+    }
     
     //make sure this thread holds the lock
     assert(lock_do_i_hold(lock)==1); 
@@ -178,18 +659,33 @@ lock_release(struct lock *lock)
     //make sure current thread is holding lock before trying to release it
     assert(lock_do_i_hold(lock)); 
     assert(lock->status == HELD);
+    prof_released(lock->prof, lock->hold_start);
+    prof_signaled(lock->prof, lock->waiters.count > 0);
 
-    //free lock and set fields to indicate no thread is holding it
-    lock->status=FREE;
-    lock->holder=NULL;
-    assert(lock->status == FREE);
+    //threads waiting -> hand the lock straight to the oldest one (it stays HELD)
+    if(lock->waiters.count > 0){
+        lock->holder = waitq_wake_one(&lock->waiters);
+        lock->hold_start = prof_now();
+    }
 
-    //wake up threads sleeping on the lock
-    thread_wakeup(lock);
+    //free lock and set fields to indicate no thread is holding it
+    else{
+        lock->status=FREE;
+        lock->holder=NULL;
+        assert(lock->status == FREE);
+    }
     splx(spl);
 
 }
 
+void
+lock_set_adaptive(struct lock *lock, int adaptive)
+{
+    assert(lock != NULL);
+
+    lock->adaptive = adaptive;
+}
+
 int
 lock_do_i_hold(struct lock *lock)
 {
@@ -224,7 +720,8 @@ cv_create(const char *name)
 		return NULL;
 	}
 	
-	// add stuff here as needed
+	// nobody waiting yet
+	waitq_init(&cv->waiters);
 	
 	return cv;
 }
@@ -232,9 +729,13 @@ cv_create(const char *name)
 void
 cv_destroy(struct cv *cv)
 {
+	int spl;
 	assert(cv != NULL);
 
-	// add stuff here as needed
+	// make sure no threads are waiting on the cv
+	spl = splhigh();
+	assert(cv->waiters.count == 0);
+	splx(spl);
 	
 	kfree(cv->name);
 	kfree(cv);
@@ -243,23 +744,134 @@ cv_destroy(struct cv *cv)
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	int spl;
+	struct synch_waiter self;
+
+	assert(cv != NULL);
+	assert(lock != NULL);
+	assert(in_interrupt == 0);
+	assert(lock_do_i_hold(lock));
+
+	spl = splhigh();
+
+	/*
+	 * Get in line before letting go of the lock. Interrupts are off,
+	 * so no signal can slip in between the release and the sleep.
+	 */
+	waitq_enqueue(&cv->waiters, &self);
+	lock_release(lock);
+	waitq_sleep(&self);
+
+	splx(spl);
+
+	lock_acquire(lock);
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	int spl;
+	assert(cv != NULL);
+	assert(lock != NULL);
+	assert(lock_do_i_hold(lock));
+
+	// wake the longest waiting thread only
+	spl = splhigh();
+	waitq_wake_one(&cv->waiters);
+	splx(spl);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	int spl;
+	assert(cv != NULL);
+	assert(lock != NULL);
+	assert(lock_do_i_hold(lock));
+
+	// wake every waiter, oldest first
+	spl = splhigh();
+	while (waitq_wake_one(&cv->waiters) != NULL) {
+		// nothing
+	}
+	splx(spl);
+}
+
+
+////////////////////////////////////////////////////////////
+//
+// Countdown latch
+
+struct latch *
+latch_create(const char *name, int count)
+{
+	struct latch *latch;
+
+	assert(count >= 0);
+
+	latch = kmalloc(sizeof(struct latch));
+	if (latch == NULL) {
+		return NULL;
+	}
+
+	latch->name = kstrdup(name);
+	if (latch->name == NULL) {
+		kfree(latch);
+		return NULL;
+	}
+
+	atomic_set(&latch->count, count);
+	return latch;
+}
+
+void
+latch_destroy(struct latch *latch)
+{
+	int spl;
+	assert(latch != NULL);
+
+	// make sure no threads are waiting on the latch
+	spl = splhigh();
+	assert(thread_hassleepers(latch) == 0);
+	splx(spl);
+
+	kfree(latch->name);
+	kfree(latch);
+}
+
+void
+latch_count_down(struct latch *latch)
+{
+	int spl, old;
+	assert(latch != NULL);
+
+	/*
+	 * The decrement that reaches 0 and the wakeup happen in one splhigh
+	 * section: a waiter that sees 0 (it only looks at splhigh) may go on
+	 * to destroy the latch, so nothing may touch it after that.
+	 */
+	spl = splhigh();
+	old = atomic_add(&latch->count, -1);
+	assert(old > 0);
+
+	// only the last one in touches the sleepers, all of them at once
+	if (old == 1) {
+		thread_wakeup(latch);
+	}
+	splx(spl);
+}
+
+void
+latch_wait(struct latch *latch)
+{
+	int spl;
+
+	assert(latch != NULL);
+	assert(in_interrupt == 0);
+
+	spl = splhigh();
+	while (atomic_read(&latch->count) != 0) {
+		thread_sleep(latch);
+	}
+	splx(spl);
 }
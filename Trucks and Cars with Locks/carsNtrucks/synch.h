@@ -0,0 +1,218 @@
+/*
+ * Header file for synchronization primitives.
+ */
+
+#ifndef _SYNCH_H_
+#define _SYNCH_H_
+
+struct thread;
+struct synch_prof;
+
+/*
+ * Atomic integer.
+ * Operations:
+ *    atomic_read  - Return the value.
+ *    atomic_set   - Set the value (for initialization, or when nobody else
+ *                   can be touching it).
+ *    atomic_add   - Add delta and return the value from before the add.
+ *    atomic_cas   - If the value is old, make it new. Returns true if it did.
+ *    atomic_dec_and_test - Decrement, and return true if that took the
+ *                   value to 0 (exactly one caller sees the 0).
+ *
+ * None of them sleep or need any setup, so a struct atomic can be a plain
+ * static variable. Built on the compiler's __atomic builtins when
+ * SYNCH_HAVE_ATOMICS is defined (for multiprocessor builds), on splhigh
+ * otherwise.
+ */
+
+struct atomic {
+	volatile int value;
+};
+
+int  atomic_read(struct atomic *);
+void atomic_set(struct atomic *, int value);
+int  atomic_add(struct atomic *, int delta);
+int  atomic_cas(struct atomic *, int old, int new);
+int  atomic_dec_and_test(struct atomic *);
+
+/*
+ * FIFO queue of sleeping threads.
+ *
+ * Every waiter sleeps on the address of its own node (which lives on
+ * its stack), so waking the node at the head wakes exactly one thread
+ * instead of everyone sleeping on the primitive. Only touched at
+ * splhigh.
+ */
+
+struct synch_waiter {
+	struct thread *thread;
+	volatile int woken;
+	struct synch_waiter *next;
+};
+
+struct synch_waitq {
+	struct synch_waiter *head;
+	struct synch_waiter *tail;
+	volatile int count;
+};
+
+/*
+ * Dijkstra-style semaphore.
+ * Operations:
+ *     P (proberen): decrement count. If the count is 0, block until
+ *                   the count is 1 again before decrementing.
+ *     V (verhogen): increment count.
+ *
+ * Both operations are atomic.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+
+struct semaphore {
+	char *name;
+	volatile int count;
+	struct synch_prof *prof;        /* contention stats (SYNCH_PROFILE) */
+};
+
+struct semaphore *sem_create(const char *name, int initial_count);
+void              P(struct semaphore *);
+void              V(struct semaphore *);
+void              sem_destroy(struct semaphore *);
+
+
+/*
+ * Simple lock for mutual exclusion.
+ * Operations:
+ *    lock_acquire - Get the lock. Only one thread can hold the lock at the
+ *                   same time.
+ *    lock_release - Free the lock. Only the thread holding the lock may do
+ *                   this.
+ *    lock_do_i_hold - Return true if the current thread holds the lock;
+ *                   false otherwise.
+ *
+ * These operations must be atomic. You get to write them.
+ *
+ * When the lock is created, no thread should be holding it. Likewise,
+ * when the lock is destroyed, no thread should be holding it.
+ *
+ * A released lock with waiters goes straight to the oldest waiter, so
+ * acquisition order is FIFO and each release wakes one thread.
+ *
+ *    lock_set_adaptive - Make a contended lock_acquire first spin for a
+ *                   while (yielding, so the holder can run) as long as the
+ *                   holder isn't asleep and nobody is queued, before going
+ *                   to sleep. The spin budget follows a running average of
+ *                   the spins recent acquisitions needed. For locks held
+ *                   over short critical sections.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+
+struct lock {
+	char *name;
+	volatile int status;            /* HELD or FREE */
+	struct thread *volatile holder; /* thread holding the lock, NULL if FREE */
+	struct synch_waitq waiters;     /* threads waiting for the lock, oldest first */
+	volatile int adaptive;          /* spin before sleeping (lock_set_adaptive) */
+	volatile int spin_budget;       /* running average of spins needed, scaled by 8 */
+	struct synch_prof *prof;        /* contention stats (SYNCH_PROFILE) */
+	u_int64_t hold_start;           /* when the holder got it, for the stats */
+};
+
+struct lock *lock_create(const char *name);
+void         lock_acquire(struct lock *);
+void         lock_release(struct lock *);
+int          lock_do_i_hold(struct lock *);
+void         lock_set_adaptive(struct lock *, int adaptive);
+void         lock_destroy(struct lock *);
+
+
+/*
+ * Condition variable.
+ *
+ * Note that the "variable" is a bit of a misnomer: a CV is normally used
+ * to wait until a variable meets a particular condition, but there's no
+ * actual variable, as such, in the CV.
+ *
+ * Operations:
+ *    cv_wait      - Release the supplied lock, go to sleep, and, after
+ *                   waking up again, re-acquire the lock.
+ *    cv_signal    - Wake up one thread that's sleeping on this CV.
+ *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *
+ * For all three operations, the current thread must hold the lock passed
+ * in. Note that under normal circumstances the same lock should be used
+ * on all operations with any particular CV.
+ *
+ * Waiters are woken in the order they started waiting.
+ *
+ * These CVs are expected to support Mesa semantics, that is, no
+ * guarantees are made about scheduling.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+
+struct cv {
+	char *name;
+	struct synch_waitq waiters;
+};
+
+struct cv *cv_create(const char *name);
+void       cv_wait(struct cv *cv, struct lock *lock);
+void       cv_signal(struct cv *cv, struct lock *lock);
+void       cv_broadcast(struct cv *cv, struct lock *lock);
+void       cv_destroy(struct cv *);
+
+
+/*
+ * Countdown latch.
+ * Operations:
+ *    latch_count_down - Take one off the count. Doesn't block; the call
+ *                   that takes it to 0 wakes every waiter before it
+ *                   returns, so once latch_wait returns the latch can be
+ *                   destroyed.
+ *    latch_wait   - Block until the count is 0 (returns right away if it
+ *                   already is).
+ *
+ * Counting down more times than the count it was created with is an
+ * error. A latch can't be reset, create a new one instead.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+
+struct latch {
+	char *name;
+	struct atomic count;
+};
+
+struct latch *latch_create(const char *name, int count);
+void          latch_count_down(struct latch *);
+void          latch_wait(struct latch *);
+void          latch_destroy(struct latch *);
+
+
+/*
+ * Contention profiling (build with SYNCH_PROFILE).
+ *
+ * lock_acquire/lock_release and P/V keep counters per primitive name:
+ * acquisitions, contended acquisitions (the caller had to spin or
+ * sleep), total and maximum wait time, releases (lock_release or V) and
+ * how many of them went to a sleeping thread and, for locks, a histogram
+ * of hold times. A lock handed to a waiter is held from the handoff on,
+ * so the time the waiter takes to wake up counts as hold time. Primitives of the same kind and name share their counters,
+ * which outlive the primitives, so they add up across create/destroy.
+ *
+ *    synch_prof_reset - Zero all the counters.
+ *    synch_prof_dump  - Print them, most total wait time first.
+ *
+ * Without SYNCH_PROFILE nothing is counted and both do nothing.
+ */
+
+void synch_prof_reset(void);
+void synch_prof_dump(void);
+
+#endif /* _SYNCH_H_ */
@@ -0,0 +1,13 @@
+/*
+ * User-space stand-in for the OS/161 <clock.h>.
+ */
+
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <time.h>
+
+/* Monotonic time, split like the kernel's. */
+void gettime(time_t *secs, u_int32_t *nsecs);
+
+#endif /* _CLOCK_H_ */
@@ -0,0 +1,12 @@
+/*
+ * User-space stand-in for the OS/161 <curthread.h>.
+ */
+
+#ifndef _CURTHREAD_H_
+#define _CURTHREAD_H_
+
+struct thread;
+
+extern __thread struct thread *curthread;
+
+#endif /* _CURTHREAD_H_ */
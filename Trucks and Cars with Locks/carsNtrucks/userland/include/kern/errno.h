@@ -0,0 +1,10 @@
+/*
+ * User-space stand-in for the OS/161 <kern/errno.h>.
+ */
+
+#ifndef _KERN_ERRNO_H_
+#define _KERN_ERRNO_H_
+
+#include <errno.h>
+
+#endif /* _KERN_ERRNO_H_ */
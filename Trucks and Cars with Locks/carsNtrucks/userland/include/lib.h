@@ -0,0 +1,23 @@
+/*
+ * User-space stand-in for the OS/161 <lib.h>: kernel allocation, printing
+ * and panic on top of libc.
+ */
+
+#ifndef _LIB_H_
+#define _LIB_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define kmalloc(size) malloc(size)
+#define kfree(ptr)    free(ptr)
+#define kstrdup(str)  strdup(str)
+
+/* Vehicle threads only print with -v, see kern.c. */
+int kprintf(const char *fmt, ...);
+
+void panic(const char *fmt, ...);
+
+#endif /* _LIB_H_ */
@@ -0,0 +1,18 @@
+/*
+ * User-space stand-in for the OS/161 <machine/spl.h>.
+ *
+ * "Interrupts off" is one process wide mutex: a thread at splhigh is the
+ * only one running kernel code that cares, as on a uniprocessor.
+ */
+
+#ifndef _MACHINE_SPL_H_
+#define _MACHINE_SPL_H_
+
+int splhigh(void);
+int spl0(void);
+void splx(int);
+
+/* Never set: there are no interrupt handlers. */
+extern int in_interrupt;
+
+#endif /* _MACHINE_SPL_H_ */
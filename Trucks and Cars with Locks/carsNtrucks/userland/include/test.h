@@ -0,0 +1,10 @@
+/*
+ * User-space stand-in for the OS/161 <test.h> (only what stoplight.c provides).
+ */
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+int createvehicles(int nargs, char **args);
+
+#endif /* _TEST_H_ */
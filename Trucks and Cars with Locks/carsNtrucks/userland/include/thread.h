@@ -0,0 +1,30 @@
+/*
+ * User-space stand-in for the OS/161 <thread.h>.
+ *
+ * Every pthread that runs kernel code (the main thread and the vehicle
+ * workers, see kern.c) has a struct thread of its own.
+ */
+
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+#include <pthread.h>
+
+struct thread {
+	const char *t_name;
+	const volatile void *t_sleepaddr; /* what it sleeps on, NULL when running */
+	struct thread *t_next;            /* next sleeper in the same bucket */
+	pthread_cond_t t_cv;              /* signaled by thread_wakeup */
+};
+
+/* Queues func(data1, data2) for the worker pool; ret is always set to NULL. */
+int thread_fork(const char *name, void *data1, unsigned long data2,
+		void (*func)(void *, unsigned long), struct thread **ret);
+
+/* Same rules as the kernel: sleep/wakeup/hassleepers only at splhigh. */
+void thread_sleep(const void *addr);
+void thread_wakeup(const void *addr);
+int thread_hassleepers(const void *addr);
+void thread_yield(void);
+
+#endif /* _THREAD_H_ */
@@ -0,0 +1,370 @@
+/* User-space host for the stoplight simulation: runs stoplight.c and synch.c, unchanged, on pthreads.
+ *
+ * Usage: stoplight [-n vehicles] [-t truck%] [-l a:b:c] [-p platoon] [-s locks|signal] [-w workers] [-r runs] [-d us] [-v]
+ *
+ * - -l is the relative traffic of lanes A, B and C (default 1:1:1), -p the most vehicles of a
+ *   route that cross on one section acquisition (default 1, no platoons), -s how vehicles get
+ *   into the intersection (default locks, signal runs a traffic signal controller), -r repeats the run
+ * - provides the kernel calls stoplight.c and synch.c make (headers in userland/include):
+ *   splhigh is one process wide mutex, thread_sleep/thread_wakeup are per-thread condvars
+ *   hashed by sleep address, gettime is the monotonic clock
+ * - thread_fork queues the vehicle for a fixed pool of worker threads, so a million vehicles
+ *   don't need a million threads (a vehicle only ever waits on vehicles that are already running,
+ *   or on the signal controller, which is forked first, so the pool can't deadlock; -s signal
+ *   needs at least 2 workers though)
+ * - vehicle output (the event log createvehicles prints after the run, plus anything a forked
+ *   thread prints) is dropped unless -v, the rest of what createvehicles prints (the throughput
+ *   and latency report) always shows
+ * - -d makes every vehicle line take that many microseconds, printed or not (an OS/161 kprintf
+ *   sleeps until the console took the line)
+ *
+ * Build from carsNtrucks:
+ *   cc -O2 -pthread -DSYNCH_HAVE_ATOMICS -Iuserland/include -I. userland/kern.c synch.c stoplight.c -o stoplight
+ * (add -DSYNCH_PROFILE for the lock contention report; make and make SYNCH_PROFILE=1 do the same,
+ * make smoke also runs 1000 vehicles through the signal)
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <thread.h>
+#include <curthread.h>
+#include <clock.h>
+#include <test.h>
+#include <machine/spl.h>
+#include <kern/errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sched.h>
+
+//sleeping threads are hashed by sleep address into this many lists
+#define SLEEP_BUCKETS 256
+
+#define DEFAULT_WORKERS 32
+
+/*
+ * A thread_fork call waiting for a worker.
+ */
+typedef struct vehicle_job {
+	void (*func)(void *, unsigned long);
+	void *data1;
+	unsigned long data2;
+} vehicle_job;
+
+__thread struct thread *curthread;
+int in_interrupt = 0;
+
+//splhigh
+static pthread_mutex_t spl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int spl_high;
+
+//sleepers, only touched at splhigh
+static struct thread *sleepers[SLEEP_BUCKETS];
+
+//worker pool queue (jobs[head..tail) still to run)
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cv = PTHREAD_COND_INITIALIZER;
+static vehicle_job *jobs;
+static size_t jobs_head, jobs_tail, jobs_capacity;
+
+static struct thread main_thread = { "main", NULL, NULL, PTHREAD_COND_INITIALIZER };
+static int verbose;
+static long console_ns;
+
+//helper prototypes
+struct thread **sleep_bucket(const volatile void *addr);
+void *worker(void *arg);
+int vehicle_line(const char *fmt);
+
+int splhigh(void){
+
+	if(spl_high){
+		return 1;
+	}
+
+	pthread_mutex_lock(&spl_mutex);
+	spl_high = 1;
+	return 0;
+}
+
+void splx(int spl){
+
+	if(spl == 0 && spl_high){
+		spl_high = 0;
+		pthread_mutex_unlock(&spl_mutex);
+	}
+}
+
+int spl0(void){
+
+	int old = spl_high;
+
+	splx(0);
+	return old;
+}
+
+/*
+ * HELPER
+ * List of the threads that may be sleeping on addr.
+ */
+struct thread **sleep_bucket(const volatile void *addr){
+
+	return &sleepers[((uintptr_t)addr >> 4) % SLEEP_BUCKETS];
+}
+
+void thread_sleep(const void *addr){
+
+	struct thread **bucket = sleep_bucket(addr);
+
+	assert(spl_high);
+	assert(addr != NULL);
+
+	curthread->t_sleepaddr = addr;
+	curthread->t_next = *bucket;
+	*bucket = curthread;
+
+	//thread_wakeup clears t_sleepaddr (the wait lets go of splhigh meanwhile)
+	while(curthread->t_sleepaddr != NULL){
+		pthread_cond_wait(&curthread->t_cv, &spl_mutex);
+	}
+}
+
+void thread_wakeup(const void *addr){
+
+	struct thread **link = sleep_bucket(addr);
+
+	assert(spl_high);
+
+	while(*link != NULL){
+		struct thread *t = *link;
+
+		if(t->t_sleepaddr == addr){
+			*link = t->t_next;
+			t->t_next = NULL;
+			t->t_sleepaddr = NULL;
+			pthread_cond_signal(&t->t_cv);
+		}
+		else{
+			link = &t->t_next;
+		}
+	}
+}
+
+int thread_hassleepers(const void *addr){
+
+	struct thread *t;
+
+	assert(spl_high);
+
+	for(t = *sleep_bucket(addr); t != NULL; t = t->t_next){
+		if(t->t_sleepaddr == addr){
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void thread_yield(void){
+
+	sched_yield();
+}
+
+int thread_fork(const char *name, void *data1, unsigned long data2,
+		void (*func)(void *, unsigned long), struct thread **ret){
+
+	(void)name;
+
+	if(ret != NULL){
+		*ret = NULL;
+	}
+
+	pthread_mutex_lock(&pool_mutex);
+
+	//everything queued has been taken -> start over at the front
+	if(jobs_head == jobs_tail){
+		jobs_head = jobs_tail = 0;
+	}
+
+	if(jobs_tail == jobs_capacity){
+		size_t capacity = jobs_capacity ? jobs_capacity * 2 : 1024;
+		vehicle_job *grown = realloc(jobs, capacity * sizeof(vehicle_job));
+
+		if(grown == NULL){
+			pthread_mutex_unlock(&pool_mutex);
+			return ENOMEM;
+		}
+		jobs = grown;
+		jobs_capacity = capacity;
+	}
+
+	jobs[jobs_tail].func = func;
+	jobs[jobs_tail].data1 = data1;
+	jobs[jobs_tail].data2 = data2;
+	jobs_tail++;
+
+	pthread_cond_signal(&pool_cv);
+	pthread_mutex_unlock(&pool_mutex);
+	return 0;
+}
+
+/*
+ * HELPER
+ * Worker pool thread: runs queued thread_fork calls one after the other as thread arg.
+ */
+void *worker(void *arg){
+
+	curthread = arg;
+
+	while(1){
+		vehicle_job job;
+
+		pthread_mutex_lock(&pool_mutex);
+		while(jobs_head == jobs_tail){
+			pthread_cond_wait(&pool_cv, &pool_mutex);
+		}
+		job = jobs[jobs_head++];
+		pthread_mutex_unlock(&pool_mutex);
+
+		job.func(job.data1, job.data2);
+		assert(!spl_high);
+	}
+
+	return NULL;
+}
+
+void gettime(time_t *secs, u_int32_t *nsecs){
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	*secs = now.tv_sec;
+	*nsecs = now.tv_nsec;
+}
+
+/*
+ * HELPER
+ * True for a line about a vehicle: anything from a forked thread, or an event log line (every
+ * print_info format starts with the vehicle's type and number).
+ */
+int vehicle_line(const char *fmt){
+
+	return curthread != &main_thread || strncmp(fmt, "%s %lu from ", 12) == 0;
+}
+
+int kprintf(const char *fmt, ...){
+
+	va_list ap;
+	int len;
+	int vehicle = vehicle_line(fmt);
+
+	//a vehicle's line takes as long as the console would
+	if(console_ns > 0 && vehicle){
+		struct timespec wait = { console_ns / 1000000000L, console_ns % 1000000000L };
+
+		nanosleep(&wait, NULL);
+	}
+
+	//vehicles are quiet unless asked, the main thread's reports always show
+	if(!verbose && vehicle){
+		return 0;
+	}
+
+	va_start(ap, fmt);
+	len = vprintf(fmt, ap);
+	va_end(ap);
+
+	return len;
+}
+
+void panic(const char *fmt, ...){
+
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "panic: ");
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	abort();
+}
+
+int main(int argc, char *argv[]){
+
+	long vehicles = 20, truck_percent = 50, platoon = 1, workers = DEFAULT_WORKERS, runs = 1;
+	int lanes[3] = {1, 1, 1};
+	char *strategy = "locks";
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:t:l:p:s:w:r:d:v")) != -1){
+		switch(opt){
+			case 'n': vehicles = atol(optarg); break;
+			case 't': truck_percent = atol(optarg); break;
+			case 'l':
+				if(sscanf(optarg, "%d:%d:%d", &lanes[0], &lanes[1], &lanes[2]) != 3){
+					fprintf(stderr, "%s: -l wants a:b:c\n", argv[0]);
+					return 1;
+				}
+				break;
+			case 'p': platoon = atol(optarg); break;
+			case 's': strategy = optarg; break;
+			case 'w': workers = atol(optarg); break;
+			case 'r': runs = atol(optarg); break;
+			case 'd': console_ns = atol(optarg) * 1000; break;
+			case 'v': verbose = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-n vehicles] [-t truck%%] [-l a:b:c] [-p platoon] [-s locks|signal] [-w workers] [-r runs] [-d us] [-v]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(workers < 1){
+		fprintf(stderr, "%s: need at least one worker\n", argv[0]);
+		return 1;
+	}
+
+	//the signal controller keeps one worker to itself
+	if(strcmp(strategy, "signal") == 0 && workers < 2){
+		fprintf(stderr, "%s: -s signal needs at least two workers\n", argv[0]);
+		return 1;
+	}
+
+	curthread = &main_thread;
+
+	//worker pool, each worker is a kernel thread of its own
+	for(long i = 0; i < workers; i++){
+		struct thread *t = calloc(1, sizeof(struct thread));
+		pthread_t tid;
+
+		if(t == NULL){
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		t->t_name = "vehicle worker";
+		pthread_cond_init(&t->t_cv, NULL);
+
+		if(pthread_create(&tid, NULL, worker, t) != 0){
+			fprintf(stderr, "%s: can't start worker %ld\n", argv[0], i);
+			return 1;
+		}
+		pthread_detach(tid);
+	}
+
+	//same arguments the sp menu command passes on
+	char n_arg[24], t_arg[24], a_arg[24], b_arg[24], c_arg[24], p_arg[24];
+	char *args[] = {"stoplight", n_arg, t_arg, a_arg, b_arg, c_arg, p_arg, strategy};
+
+	snprintf(n_arg, sizeof(n_arg), "%ld", vehicles);
+	snprintf(t_arg, sizeof(t_arg), "%ld", truck_percent);
+	snprintf(a_arg, sizeof(a_arg), "%d", lanes[0]);
+	snprintf(b_arg, sizeof(b_arg), "%d", lanes[1]);
+	snprintf(c_arg, sizeof(c_arg), "%d", lanes[2]);
+	snprintf(p_arg, sizeof(p_arg), "%ld", platoon);
+
+	for(long run = 0; run < runs; run++){
+		if(createvehicles(8, args) != 0){
+			return 1;
+		}
+	}
+
+	return 0;
+}